@@ -3,83 +3,534 @@
 //
 
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
 
 #include "Rasterizer.h"
-#include "util.h"
+
+using namespace rasterizer_detail;
+
+namespace {
+
+#ifdef MR_DEPTH_INT24
+constexpr depth_t depth_clear = 0;
+#else
+constexpr depth_t depth_clear = -std::numeric_limits<float>::infinity();
+#endif
+
+Rasterizer::FillKernel best_fill_kernel() {
+#ifdef MR_FILL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return Rasterizer::FillKernel::AVX2;
+    if (__builtin_cpu_supports("sse2")) return Rasterizer::FillKernel::SSE2;
+#endif
+    return Rasterizer::FillKernel::Scalar;
+}
+
+}
 
 Rasterizer::Rasterizer(int w, int h) : width(w), height(h) {
+    tiles_x = (w + tile_size - 1) / tile_size;
+    tiles_y = (h + tile_size - 1) / tile_size;
+    tile_bins.resize(tiles_x * tiles_y);
+    blocks_x = (w + hiz_block_size - 1) / hiz_block_size;
+    blocks_y = (h + hiz_block_size - 1) / hiz_block_size;
+    hiz_far.resize(blocks_x * blocks_y);
+    hiz_near.resize(blocks_x * blocks_y);
+    hiz_dirty.resize(blocks_x * blocks_y);
+#ifdef MR_INSTRUMENT
+    tile_counters.resize(tiles_x * tiles_y);
+    overdraw.resize(w * h);
+#endif
     z_buffer.resize(w * h);
-    framebuffer.resize(w * h);
+    color_buffer.resize(w * h);
+    fill_kernel = best_fill_kernel();
     clear();
 }
 
+void Rasterizer::set_fill_kernel(FillKernel kernel) {
+    fill_kernel = std::min(kernel, best_fill_kernel());
+}
+
 void Rasterizer::clear() {
-    model = identity_matrix<4>();
     view = identity_matrix<4>();
     projection = identity_matrix<4>();
     viewport = {{{width/2., 0,   0, width/2.},
                         {0,   height/2., 0, height/2.},
                         {0,   0,   1,   0},
                         {0,   0,   0,   1}}};
-    vertices = {};
-    indices = {};
-    std::fill(framebuffer.begin(), framebuffer.end(), vec3());
-    std::fill(z_buffer.begin(), z_buffer.end(), -std::numeric_limits<double>::infinity());
+    cull_mode = CullMode::None;
+    near_w = 1e-5;
+    lod_error = 0;
+    samples = 1;
+    sample_depth = {};
+    sample_slot = {};
+    sample_slots = {};
+    clip_vertices = {};
+    varying_count = 0;
+    vertex_varyings = {};
+    screen_vertices = {};
+    outcodes = {};
+    clear_targets();
+}
+
+void Rasterizer::clear_targets() {
+    std::fill(color_buffer.begin(), color_buffer.end(), pack_color(vec3().to_color()));
+    std::fill(z_buffer.begin(), z_buffer.end(), depth_clear);
+    std::fill(hiz_far.begin(), hiz_far.end(), depth_clear);
+    std::fill(hiz_near.begin(), hiz_near.end(), depth_clear);
+    std::fill(hiz_dirty.begin(), hiz_dirty.end(), 0);
+    std::fill(sample_depth.begin(), sample_depth.end(), depth_clear);
+    std::fill(sample_slot.begin(), sample_slot.end(), -1);
+    for (SampleSlots& slots : sample_slots) {
+        slots.colors.clear();
+        slots.free.clear();
+    }
+#ifdef MR_INSTRUMENT
+    std::fill(overdraw.begin(), overdraw.end(), 0);
+#endif
+}
+
+bool Rasterizer::set_samples(int n) {
+    if (n != 1 && n != 2 && n != 4 && n != 8) {
+        std::cerr << "unsupported sample count " << n << ", expected 1, 2, 4 or 8\n";
+        return false;
+    }
+    samples = n;
+    const size_t npixel = static_cast<size_t>(width) * height;
+    sample_depth.assign(n > 1 ? npixel * n : 0, depth_clear);
+    sample_slot.assign(n > 1 ? npixel : 0, -1);
+    sample_slots.assign(n > 1 ? tiles_x * tiles_y : 0, {});
+    clear_targets();
+    return true;
+}
+
+void Rasterizer::draw_depth(const Mesh& mesh, std::span<const mat4> models) {
+    const DepthPass pass;
+    prepare_draw(mesh, models, pass);
+    auto start = std::chrono::steady_clock::now();
+    rasterize_tiles(pass);
+    lap(start, stage_times.fill, "fill");
+    triangles.clear();
+}
+
+// vertex stage: concatenate the matrices once per instance and transform every vertex exactly once, shared vertices
+// are then read back by index instead of being transformed once per face; results go to the entries from first on
+void Rasterizer::process_vertices(const Mesh& mesh, const mat4& mvp, int first, int begin, int end) {
+#ifdef MR_FLOAT_VERTEX_STAGE
+    float_clip_vertices.resize(end - begin);
+    transform_points(to_mat4f(mvp), mesh.float_vertices.data() + begin, float_clip_vertices.data(), end - begin);
+#endif
+    for (int j = begin; j < end; j++) {
+#ifdef MR_FLOAT_VERTEX_STAGE
+        const vec4 v = to_vec4(float_clip_vertices[j - begin]);
+#else
+        const vec4 v = mvp * mesh.vertices[j].to_vec4(1.);
+#endif
+        const size_t i = first + j;
+        std::uint8_t code = outcode(v);
+        if (!(code & Near)) {
+            if (beyond_guard_band(v)) code |= Guard;
+            screen_vertices[i] = v.to_vec3();
+        }
+        clip_vertices[i] = v;
+        outcodes[i] = code;
+    }
 }
 
-void Rasterizer::load_vertices(const std::vector<vec3>& vertices_) {
-    vertices.insert(vertices.end(), vertices_.begin(), vertices_.end());
+// merges the vertex ranges of the clusters from visible_clusters[first_cluster] on into disjoint sorted ranges
+void Rasterizer::collect_vertex_ranges(const Mesh& mesh, size_t first_cluster) {
+    vertex_ranges.clear();
+    for (size_t i = first_cluster; i < visible_clusters.size(); i++) {
+        const Cluster& cluster = mesh.clusters[visible_clusters[i].second];
+        vertex_ranges.emplace_back(cluster.first_vertex, cluster.last_vertex + 1);
+    }
+    std::sort(vertex_ranges.begin(), vertex_ranges.end());
+    size_t merged = 0;
+    for (size_t i = 0; i < vertex_ranges.size(); i++) {
+        if (merged > 0 && vertex_ranges[i].first <= vertex_ranges[merged - 1].second)
+            vertex_ranges[merged - 1].second = std::max(vertex_ranges[merged - 1].second, vertex_ranges[i].second);
+        else
+            vertex_ranges[merged++] = vertex_ranges[i];
+    }
+    vertex_ranges.resize(merged);
+}
+
+// conservative: the projection of the box is the hull of its projected corners as long as they are all in front
+// of the near plane, and its nearest depth is the nearest corner's
+bool Rasterizer::box_visible(const AABB& box, const mat4& mvp) {
+    if (box.empty())
+        return false;
+    std::uint8_t common = 0xFF;
+    bool crosses_near = false;
+    AABB screen;
+    for (int i = 0; i < 8; i++) {
+        const vec4 v = mvp * box.corner(i).to_vec4(1.);
+        const std::uint8_t code = outcode(v);
+        common &= code;
+        if (code & Near) crosses_near = true;
+        else screen.extend(v.to_vec3());
+    }
+    if (common) // all corners outside the same plane
+        return false;
+    if (crosses_near)
+        return true;
+
+    // the extent is unbounded, it is tested and clamped to the screen in double before it becomes pixels
+    const double left = std::floor(screen.min.x), right = std::ceil(screen.max.x);
+    const double bottom = std::floor(screen.min.y), top = std::ceil(screen.max.y);
+    if (!(left <= width - 1. && right >= 0. && bottom <= height - 1. && top >= 0.))
+        return false;
+    const int x_min = static_cast<int>(std::max(left, 0.)), x_max = static_cast<int>(std::min(right, width - 1.));
+    const int y_min = static_cast<int>(std::max(bottom, 0.)), y_max = static_cast<int>(std::min(top, height - 1.));
+    const depth_t nearest = encode_depth(screen.max.z + 1e-12 * std::abs(screen.max.z));
+    for (int by = y_min / hiz_block_size; by <= y_max / hiz_block_size; by++) {
+        for (int bx = x_min / hiz_block_size; bx <= x_max / hiz_block_size; bx++) {
+            const int block = bx + by * blocks_x;
+            if (hiz_dirty[block]) update_hiz_block(block);
+            if (nearest >= hiz_far[block]) return true;
+        }
+    }
+    return false;
+}
+
+// the pixels per model unit are estimated from the screen extent of the bounds over their longest side,
+// which overestimates them for a box seen along a diagonal, so the chosen level errs on the fine side
+int Rasterizer::select_lod(const Mesh& mesh, const mat4& mvp) const {
+    if (mesh.lods.size() < 2 || lod_error <= 0 || mesh.bounds.empty())
+        return 0;
+    AABB screen;
+    for (int i = 0; i < 8; i++) {
+        const vec4 v = mvp * mesh.bounds.corner(i).to_vec4(1.);
+        if (outcode(v) & Near) return 0;
+        screen.extend(v.to_vec3());
+    }
+    const vec3 extent = mesh.bounds.max - mesh.bounds.min;
+    const double longest = std::max({extent.x, extent.y, extent.z});
+    if (longest <= 0)
+        return 0;
+    const double pixels_per_unit = std::max(screen.max.x - screen.min.x, screen.max.y - screen.min.y) / longest;
+    int level = 0;
+    while (level + 1 < static_cast<int>(mesh.lods.size()) && mesh.lods[level + 1].error * pixels_per_unit <= lod_error)
+        level++;
+    return level;
 }
 
-void Rasterizer::load_indices(const std::vector<int>& indices_) {
-    indices.insert(indices.end(), indices_.begin(), indices_.end());
+bool Rasterizer::is_box_visible(const AABB& box, const mat4& model) {
+    return box_visible(box, viewport * projection * view * model);
 }
 
-void Rasterizer::rasterize() {
-    int nface = static_cast<int>(indices.size()) / 3;
-    for (int i=0; i < nface; i++) { // iterate through all triangles
-        vec3 v0t1 = vertices[indices[i*3+1]] - vertices[indices[i*3+0]];
-        vec3 v1t2 = vertices[indices[i*3+2]] - vertices[indices[i*3+1]];
-        vec3 n = normalize(v0t1 ^ v1t2);
+// primitive assembly: reject and cull every face, clip it against the near plane and the guard band if needed,
+// then set up the resulting triangles for binning
+void Rasterizer::assemble_triangles(const Mesh& mesh) {
+    size_t nface = 0;
+    for (auto [instance, c] : visible_clusters) nface += mesh.clusters[c].face_count;
+    triangles.clear();
+    triangles.reserve(nface);
+    triangle_varyings.clear();
+    triangle_varyings.reserve(nface * 3 * varying_count);
 
-        vec3 normal_color {n.x * 255, n.y * 255, n.z * 255};
-        vec4 v4s[3] = {vertices[indices[i*3+0]].to_vec4(1.), vertices[indices[i*3+1]].to_vec4(1.), vertices[indices[i*3+2]].to_vec4(1.)};
-        rasterize_triangle(v4s, normal_color);
+    for (auto [instance, c] : visible_clusters) {
+        const Cluster& cluster = mesh.clusters[c];
+        const int base = instance * mesh.vertex_count();
+        for (int i = cluster.first_face; i < cluster.first_face + cluster.face_count; i++) { // iterate through all triangles
+            const int idx[3] = {mesh.indices[i*3] + base, mesh.indices[i*3 + 1] + base, mesh.indices[i*3 + 2] + base};
+            // trivial reject: all three vertices outside the same plane of the clip volume
+            if (outcodes[idx[0]] & outcodes[idx[1]] & outcodes[idx[2]] & ~Guard) {
+                MR_INSTRUMENT_ONLY(counters.triangles_culled++;)
+                continue;
+            }
+            if (cull_mode != CullMode::None) {
+                // orientation of the triangle seen from the eye, valid even when it crosses the w = 0 plane
+                const vec4 &a = clip_vertices[idx[0]], &b = clip_vertices[idx[1]], &c = clip_vertices[idx[2]];
+                double facing = a.x * (b.y * c.w - b.w * c.y) - a.y * (b.x * c.w - b.w * c.x) + a.w * (b.x * c.y - b.y * c.x);
+                if (cull_mode == CullMode::Back ? facing >= 0 : facing <= 0) {
+                    MR_INSTRUMENT_ONLY(counters.triangles_culled++;)
+                    continue;
+                }
+            }
+            if ((outcodes[idx[0]] | outcodes[idx[1]] | outcodes[idx[2]]) & (Near | Guard)) {
+                MR_INSTRUMENT_ONLY(counters.triangles_clipped++;)
+                clip_triangle(idx, i, instance);
+                continue;
+            }
+            const vec3 v3s[3] = {screen_vertices[idx[0]], screen_vertices[idx[1]], screen_vertices[idx[2]]};
+            const double w[3] = {clip_vertices[idx[0]].w, clip_vertices[idx[1]].w, clip_vertices[idx[2]].w};
+            const double* varyings[3];
+            for (int j = 0; j < 3; j++) varyings[j] = vertex_varyings.data() + idx[j] * varying_count;
+            emit_triangle(v3s, w, varyings, i, instance);
+        }
     }
 }
 
+// Sutherland-Hodgman in homogeneous space against w = near_w first, then against the guard band, which keeps
+// the snapped vertices within the range of the fixed-point edge functions; every plane adds at most one vertex, so
+// a triangle becomes at most an octagon. Varyings are linear in clip space, new vertices take them at the same t.
+void Rasterizer::clip_triangle(const int idx[3], int face, int instance) {
+    constexpr int max_vertices = 8, max_created = 10; // two per plane
+    vec4 polygon[max_vertices], clipped[max_vertices];
+    const double* varyings[max_vertices];
+    const double* clipped_varyings[max_vertices];
+    clip_varyings.resize(max_created * varying_count);
+    int n = 3, created = 0;
+    for (int i = 0; i < 3; i++) {
+        polygon[i] = clip_vertices[idx[i]];
+        varyings[i] = vertex_varyings.data() + idx[i] * varying_count;
+    }
+    // signed distance to a plane, inside where >= 0
+    auto distance = [this](const vec4& v, int plane) {
+        switch (plane) {
+            case 0: return v.w - near_w;
+            case 1: return v.x + guard_band * v.w;
+            case 2: return (width + guard_band) * v.w - v.x;
+            case 3: return v.y + guard_band * v.w;
+            default: return (height + guard_band) * v.w - v.y;
+        }
+    };
+    for (int plane = 0; plane < 5; plane++) {
+        double d[max_vertices];
+        bool all_inside = true;
+        for (int i = 0; i < n; i++) all_inside &= (d[i] = distance(polygon[i], plane)) >= 0;
+        if (all_inside) continue;
+        int m = 0;
+        for (int i = 0; i < n; i++) {
+            const int j = (i + 1) % n;
+            if (d[i] >= 0) {
+                clipped[m] = polygon[i];
+                clipped_varyings[m++] = varyings[i];
+            }
+            if ((d[i] >= 0) != (d[j] >= 0)) {
+                const double t = d[i] / (d[i] - d[j]);
+                double* out = clip_varyings.data() + created++ * varying_count;
+                for (int k = 0; k < varying_count; k++) out[k] = varyings[i][k] + (varyings[j][k] - varyings[i][k]) * t;
+                clipped[m] = polygon[i] + (polygon[j] - polygon[i]) * t;
+                clipped_varyings[m++] = out;
+            }
+        }
+        n = m;
+        std::copy_n(clipped, n, polygon);
+        std::copy_n(clipped_varyings, n, varyings);
+        if (n < 3) return;
+    }
+    vec3 v3s[max_vertices];
+    for (int i = 0; i < n; i++) v3s[i] = polygon[i].to_vec3();
+    for (int i = 1; i + 1 < n; i++) {
+        const vec3 tri_v3s[3] = {v3s[0], v3s[i], v3s[i + 1]};
+        const double tri_w[3] = {polygon[0].w, polygon[i].w, polygon[i + 1].w};
+        const double* tri_varyings[3] = {varyings[0], varyings[i], varyings[i + 1]};
+        emit_triangle(tri_v3s, tri_w, tri_varyings, face, instance);
+    }
+}
+
+void Rasterizer::emit_triangle(const vec3 v3s[3], const double w[3], const double* varyings[3], int face, int instance) {
+    Triangle tri;
+    if (!setup_triangle(v3s, tri)) {
+        MR_INSTRUMENT_ONLY(counters.triangles_culled++;)
+        return;
+    }
+    tri.face = face;
+    tri.instance = instance;
+    tri.varyings = static_cast<int>(triangle_varyings.size());
+    for (int i = 0; i < 3; i++) {
+        tri.inv_w[i] = 1. / w[i];
+        for (int k = 0; k < varying_count; k++) triangle_varyings.push_back(varyings[i][k] * tri.inv_w[i]);
+    }
+    triangles.push_back(tri);
+    MR_INSTRUMENT_ONLY(counters.triangles_rasterized++;)
+}
+
 void Rasterizer::drawonTGA(TGAImage& framebuffer_) {
+    if (framebuffer_.width() != width || framebuffer_.height() != height)
+        return;
+    auto start = std::chrono::steady_clock::now();
+    // color_buffer is already in TGA byte order, copy the leading bytes of every pixel the image keeps
+    std::uint8_t* dst = framebuffer_.buffer();
+    const int bpp = framebuffer_.bytespp();
+    const int npixel = width * height;
+    if (samples > 1) {
+        // the first bpp bytes of the BGRA word, as below
+#pragma omp parallel for schedule(static, 16)
+        for (int i = 0; i < npixel; i++) {
+            const std::uint32_t color = resolve_samples(i);
+            memcpy(dst + i * bpp, &color, bpp);
+        }
+    } else if (bpp == TGAImage::RGBA) {
+        memcpy(dst, color_buffer.data(), npixel * sizeof(std::uint32_t));
+    } else if (bpp == TGAImage::RGB) {
+        for (int i = 0; i < npixel; i++) memcpy(dst + i * 3, &color_buffer[i], 3);
+    } else {
+        for (int i = 0; i < npixel; i++) dst[i] = color_buffer[i] & 0xFF;
+    }
+    lap(start, stage_times.resolve, "resolve");
+}
+
+bool Rasterizer::draw_overdraw([[maybe_unused]] TGAImage& image) const {
+#ifdef MR_INSTRUMENT
+    if (image.width() != width || image.height() != height)
+        return false;
+    // BGRA by number of passes, 5 to 7 are red and 8 or more white
+    constexpr TGAColor ramp[] = {{0, 0, 0, 255}, {255, 0, 0, 255}, {0, 200, 0, 255}, {0, 230, 230, 255},
+                                 {0, 140, 255, 255}, {0, 0, 255, 255}, {0, 0, 255, 255}, {0, 0, 255, 255},
+                                 {255, 255, 255, 255}};
     for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            framebuffer_.set(x, y, framebuffer[get_index(x, y)].to_color());
+        for (int x = 0; x < width; x++) image.set(x, y, ramp[std::min<int>(overdraw[get_index(x, y)], 8)]);
+    }
+    return true;
+#else
+    std::cerr << "overdraw needs a build with MR_INSTRUMENT\n";
+    return false;
+#endif
+}
+
+#ifdef MR_INSTRUMENT
+void Rasterizer::merge_tile_counters() {
+    for (PipelineCounters& tile : tile_counters) {
+        counters += tile;
+        tile = {};
+    }
+}
+#endif
+
+void Rasterizer::write_samples(int tile, int pixel, std::uint32_t color, int mask) {
+    std::int32_t& slot = sample_slot[pixel];
+    SampleSlots& slots = sample_slots[tile];
+    if (mask == (1 << samples) - 1) {
+        // the triangle took the whole pixel, which compresses back to a single color
+        color_buffer[pixel] = color;
+        if (slot >= 0) slots.free.push_back(slot);
+        slot = -1;
+        return;
+    }
+    if (slot < 0) {
+        if (!slots.free.empty()) {
+            slot = slots.free.back();
+            slots.free.pop_back();
+        } else {
+            slot = static_cast<std::int32_t>(slots.colors.size() / samples);
+            slots.colors.resize(slots.colors.size() + samples);
         }
+        std::fill_n(slots.colors.begin() + slot * samples, samples, color_buffer[pixel]);
     }
+    for (; mask; mask &= mask - 1) slots.colors[slot * samples + __builtin_ctz(mask)] = color;
 }
 
-void Rasterizer::rasterize_triangle(vec4 v4s[3], vec3 color) {
-    vec3 v3s[3];
+std::uint32_t Rasterizer::resolve_samples(int pixel) const {
+    const std::int32_t slot = sample_slot[pixel];
+    if (slot < 0)
+        return color_buffer[pixel];
+    const int x = pixel % width, y = pixel / width;
+    const std::uint32_t* colors = &sample_slots[x / tile_size + y / tile_size * tiles_x].colors[slot * samples];
+    std::uint32_t sum[4] = {};
+    for (int s = 0; s < samples; s++) {
+        for (int c = 0; c < 4; c++) sum[c] += colors[s] >> (8 * c) & 0xFF;
+    }
+    std::uint32_t mean = 0;
+    for (int c = 0; c < 4; c++) mean |= (sum[c] + samples / 2) / samples << (8 * c);
+    return mean;
+}
+
+bool Rasterizer::setup_triangle(const vec3 v3s[3], Triangle& tri) const {
+    // snap to the sub-pixel grid, every later coverage decision is exact integer arithmetic on these
+    std::int64_t x[3], y[3];
     for (int i = 0; i < 3; i++) {
-        v3s[i] = (viewport * projection * view * model * v4s[i]).to_vec3();
+        x[i] = std::llround(v3s[i].x * subpixel);
+        y[i] = std::llround(v3s[i].y * subpixel);
     }
+    // every sample, the pixel center or an MSAA one, lies inside its pixel, so the pixels holding the snapped vertices
+    // bound all covered ones; inside the guard band a vertex can be left of or below the screen, floor_div keeps
+    // those pixels negative where / would round them up to 0
+    const std::int64_t x_min = std::max<std::int64_t>(0, floor_div(*std::min_element(x, x + 3), subpixel));
+    const std::int64_t x_max = std::min<std::int64_t>(width - 1, floor_div(*std::max_element(x, x + 3), subpixel));
+    const std::int64_t y_min = std::max<std::int64_t>(0, floor_div(*std::min_element(y, y + 3), subpixel));
+    const std::int64_t y_max = std::min<std::int64_t>(height - 1, floor_div(*std::max_element(y, y + 3), subpixel));
+    if (x_min > x_max || y_min > y_max)
+        return false;
+    tri.x_min = static_cast<int>(x_min), tri.x_max = static_cast<int>(x_max);
+    tri.y_min = static_cast<int>(y_min), tri.y_max = static_cast<int>(y_max);
 
-    auto [x_min, x_max] = std::minmax({v3s[0].x, v3s[1].x, v3s[2].x});
-    auto [y_min, y_max] = std::minmax({v3s[0].y, v3s[1].y, v3s[2].y});
-    x_min = std::max<int>(0, std::floor(x_min));
-    x_max = std::min<int>(width - 1, std::ceil(x_max));
-    y_min = std::max<int>(0, std::floor(y_min));
-    y_max = std::min<int>(height - 1, std::ceil(y_max));
+    // edge i runs from vertex a to vertex b and is laid out like compute_barycentric_2D, so that over twice the
+    // area it is alpha, beta and gamma
+    const std::int64_t area = (x[2] - x[1]) * (y[0] - y[1]) - (y[2] - y[1]) * (x[0] - x[1]);
+    if (area == 0)
+        return false;
+    const std::int64_t sign = area > 0 ? 1 : -1;
+    constexpr std::int64_t center = subpixel / 2;
+    for (int i = 0; i < 3; i++) {
+        const int a = (i + 1) % 3, b = (i + 2) % 3;
+        const std::int64_t step_x = -sign * (y[b] - y[a]), step_y = sign * (x[b] - x[a]);
+        // top-left rule: a sample on the edge is inside when the interior lies to its right, or below a
+        // horizontal edge
+        tri.edge_bias[i] = step_x > 0 || (step_x == 0 && step_y < 0) ? 0 : 1;
+        tri.edge[i] = step_x * (center - x[a]) + step_y * (center - y[a]) - tri.edge_bias[i];
+        tri.edge_dx[i] = step_x * subpixel;
+        tri.edge_dy[i] = step_y * subpixel;
+    }
+    for (int i = 0; i < 3; i++) {
+        tri.v3s[i] = {static_cast<double>(x[i]) / subpixel, static_cast<double>(y[i]) / subpixel, v3s[i].z};
+        tri.depth_weight[i] = v3s[i].z / static_cast<double>(sign * area);
+    }
+    tri.z_dx = tri.z_dy = 0;
+    for (int i = 0; i < 3; i++) {
+        tri.z_dx += static_cast<double>(tri.edge_dx[i]) * tri.depth_weight[i];
+        tri.z_dy += static_cast<double>(tri.edge_dy[i]) * tri.depth_weight[i];
+    }
+    tri.alpha_denominator = tri.beta_denominator = static_cast<double>(area) / (subpixel * subpixel);
 
-    for (int x = x_min; x <= x_max; x++) {
-        for (int y = y_min; y <= y_max; y++) {
-            auto [alpha, beta, gamma] = compute_barycentric_2D(x + .5, y + .5, v3s);
-            if (alpha<0 || beta<0 || gamma<0)
-                continue;
+    // interpolated depth is a convex combination of the vertex depths, widened a little for rounding
+    auto [z_min, z_max] = std::minmax({v3s[0].z, v3s[1].z, v3s[2].z});
+    const double z_slack = 1e-12 * std::max(std::abs(z_min), std::abs(z_max));
+    tri.depth_min = encode_depth(z_min - z_slack);
+    tri.depth_max = encode_depth(z_max + z_slack);
+    return true;
+}
 
-            double z = alpha * v3s[0].z + beta * v3s[1].z + gamma * v3s[2].z;
-            if (z > z_buffer[get_index(x, y)]) {
-                framebuffer[get_index(x, y)] = color;
-                z_buffer[get_index(x, y)] = z;
+void Rasterizer::bin_triangles() {
+    for (auto& bin : tile_bins) bin.clear();
+    for (int i = 0; i < static_cast<int>(triangles.size()); i++) {
+        const Triangle& tri = triangles[i];
+        for (int ty = tri.y_min / tile_size; ty <= tri.y_max / tile_size; ty++) {
+            for (int tx = tri.x_min / tile_size; tx <= tri.x_max / tile_size; tx++) {
+                tile_bins[tx + ty * tiles_x].push_back(i);
             }
         }
     }
 }
+
+// coarse depth test: blocks where the whole triangle lies behind z_buffer are skipped,
+// blocks where it lies in front of z_buffer are written without per-pixel comparison;
+// returns false when every block of the region is occluded
+bool Rasterizer::classify_blocks(const Triangle& tri, int x_min, int x_max, int y_min, int y_max,
+                                 BlockState block_state[tile_blocks][tile_blocks]) {
+    const int bx_min = x_min / hiz_block_size, bx_max = x_max / hiz_block_size;
+    const int by_min = y_min / hiz_block_size, by_max = y_max / hiz_block_size;
+    bool occluded = true;
+    for (int by = by_min; by <= by_max; by++) {
+        for (int bx = bx_min; bx <= bx_max; bx++) {
+            const int block = bx + by * blocks_x;
+            if (hiz_dirty[block]) update_hiz_block(block);
+            BlockState state = Test;
+            if (tri.depth_max < hiz_far[block]) state = Occluded;
+            else if (tri.depth_min > hiz_near[block]) state = Visible;
+            block_state[by - by_min][bx - bx_min] = state;
+            occluded &= state == Occluded;
+        }
+    }
+    return !occluded;
+}
+
+void Rasterizer::update_hiz_block(int block) {
+    const int x_min = block % blocks_x * hiz_block_size, y_min = block / blocks_x * hiz_block_size;
+    const int x_max = std::min(x_min + hiz_block_size, width), y_max = std::min(y_min + hiz_block_size, height);
+    depth_t z_far = z_buffer[get_index(x_min, y_min)], z_near = z_far;
+    for (int y = y_min; y < y_max; y++) {
+        for (int x = x_min; x < x_max; x++) {
+            z_far = std::min(z_far, z_buffer[get_index(x, y)]);
+            z_near = std::max(z_near, z_buffer[get_index(x, y)]);
+        }
+    }
+    hiz_far[block] = z_far;
+    hiz_near[block] = z_near;
+    hiz_dirty[block] = 0;
+}
@@ -4,35 +4,308 @@
 
 #ifndef RASTERIZER_H
 #define RASTERIZER_H
+#include <cstring>
+#include <limits>
+#include <span>
+#include <utility>
+#include <type_traits>
 #include <vector>
 
+#include "bounds.h"
 #include "geometry.h"
+#include "geometryf.h"
+#include "instrument.h"
+#include "mesh.h"
 #include "tgaimage.h"
 
+// depth buffer format, larger is nearer: float by default, or 24-bit unsigned with MR_DEPTH_INT24, fixed point
+// over z in [-1, 1] and coarser, but still ordered, outside it (see rasterizer_detail::encode_depth)
+#ifdef MR_DEPTH_INT24
+using depth_t = std::uint32_t;
+#else
+using depth_t = float;
+#endif
+
 class Rasterizer {
 public:
+    enum class CullMode { None, Back, Front };
+    // pixel loop implementation, picked at construction from what the cpu supports
+    enum class FillKernel { Scalar, SSE2, AVX2 };
+    // what the vertex stage knows about the instance being drawn
+    struct Instance {
+        int id; // position in the draw's model matrices
+        mat4 model;
+        mat4 normal; // inverse transpose of model, for normals
+    };
+    // what a fragment shader knows about the pixel besides its varyings
+    struct Fragment {
+        int x, y;
+        int face; // index of the face in the mesh, shared by all triangles clipped from it
+        int instance;
+    };
+    // derivatives of a shader's varyings per pixel along x (dx) and y (dy), for texture level of detail
+    template<typename Varyings> struct Gradients {
+        Varyings dx, dy;
+    };
+
+    // w and h up to 16384, the range the fixed-point edge functions are sized for
     Rasterizer(int w, int h);
+    // back to the state after construction: default matrices and settings, empty render targets
     void clear();
+    // empties the color, depth and hierarchical depth buffers only, for the next frame under the same settings;
+    // the per-draw buffers keep their capacity
+    void clear_targets();
 
-    void load_vertices(const std::vector<vec3>& vertices);
-    void load_indices(const std::vector<int>& indices);
-    void set_model_matrix(const mat4& m) { model = m; }
     void set_view_matrix(const mat4& m) { view = m; }
     void set_projection_matrix(const mat4& m) { projection = m;}
+    void set_cull_mode(CullMode mode) { cull_mode = mode; }
+    // triangles are clipped against the plane w = near_w, must be > 0, and against the guard band
+    void set_near_plane(double w) { near_w = w; }
+    // falls back to the best supported kernel if the requested one is unavailable
+    void set_fill_kernel(FillKernel kernel);
+    [[nodiscard]] FillKernel get_fill_kernel() const { return fill_kernel; }
+    // every instance is drawn at the coarsest level of detail of its mesh whose error projects to at most
+    // this many pixels, 0 (the default) always draws the full detail
+    void set_lod_error(double pixels) { lod_error = pixels; }
+    // multi-sample anti-aliasing with 1 (off), 2, 4 or 8 coverage and depth samples per pixel; the fragment stage
+    // still runs once per pixel and triangle. Empties the render targets, false for other counts. While on,
+    // draw_deferred draws forward and get_depth is the farthest sample of the pixel.
+    bool set_samples(int n);
+    [[nodiscard]] int get_samples() const { return samples; }
 
-    void rasterize();
+    // Draws mesh once per model matrix with a shader known at compile time, its stages are inlined into the vertex
+    // and fill loops:
+    //   struct Shader {
+    //       struct Varyings { ... };  // doubles only (vec2, vec3, ...), interpolated perspective-correct
+    //       Varyings vertex(int index, const Rasterizer::Instance& instance) const;  // once per mesh vertex and instance
+    //       bool fragment(const Varyings& in, const Rasterizer::Fragment& frag, TGAColor& color) const;  // false discards
+    //   };
+    // A fragment stage taking a const Rasterizer::Gradients<Varyings>& before the color also gets the derivatives of
+    // the varyings at the pixel, computed only for such shaders.
+    // All instances are assembled, binned and filled in a single pass, fragment is called from several threads at once.
+    template<typename Shader> void draw(const Mesh& mesh, std::span<const mat4> models, const Shader& shader);
+    template<typename Shader> void draw(const Mesh& mesh, const mat4& model, const Shader& shader) {
+        draw(mesh, std::span(&model, 1), shader);
+    }
+    // Same result as draw when fragment never discards, but the fill loops only record which triangle won every
+    // pixel; fragment then runs once per visible pixel, in a resolve pass split across rows. A discarded pixel keeps
+    // the color it had before the draw instead of showing what lies behind it.
+    template<typename Shader> void draw_deferred(const Mesh& mesh, std::span<const mat4> models, const Shader& shader);
+    template<typename Shader> void draw_deferred(const Mesh& mesh, const mat4& model, const Shader& shader) {
+        draw_deferred(mesh, std::span(&model, 1), shader);
+    }
+    // depth-only pass, e.g. for shadow maps: no varyings, no shading and no color writes
+    void draw_depth(const Mesh& mesh, std::span<const mat4> models);
+    void draw_depth(const Mesh& mesh, const mat4& model) { draw_depth(mesh, std::span(&model, 1)); }
+    // false when box, in object space under model, certainly adds no pixel: outside the frustum or behind
+    // everything already drawn according to the hierarchical depth buffer
+    bool is_box_visible(const AABB& box, const mat4& model);
+    // wall time of every stage since construction or the last reset_stage_times(), in seconds
+    struct StageTimes {
+        double vertex = 0;  // culling, level of detail selection and the vertex shader
+        double setup = 0;   // primitive assembly, clipping, triangle setup and binning
+        double fill = 0;    // rasterization of the tiles, with the fragment shader of draw
+        double resolve = 0; // the shading pass of draw_deferred and drawonTGA
+    };
+    [[nodiscard]] const StageTimes& get_stage_times() const { return stage_times; }
+    void reset_stage_times() { stage_times = {}; }
+    // triangle and pixel counts since construction or the last reset_counters(), all zero without MR_INSTRUMENT
+    [[nodiscard]] const PipelineCounters& get_counters() const { return counters; }
+    void reset_counters() { counters = {}; }
+    // heat map of how many times every pixel passed the depth test since the last clear_targets(), from black
+    // (never) over blue, green, yellow, orange and red to white (8 times or more); false without MR_INSTRUMENT
+    bool draw_overdraw(TGAImage& image) const;
+    // depth buffer value at pixel (x, y) as an NDC z, larger is nearer
+    [[nodiscard]] double get_depth(int x, int y) const;
+    // resolves the color buffer into framebuffer, which is expected to be width x height; with MSAA every pixel
+    // gets the mean of its samples
     void drawonTGA(TGAImage& framebuffer);
 private:
+    // screen-space triangle after setup, shared read-only by all tiles it overlaps
+    struct Triangle {
+        vec3 v3s[3];
+        double inv_w[3]; // 1 / clip w of every vertex
+        int face, instance;
+        int varyings; // offset in triangle_varyings of the 3 vertices' varyings, premultiplied by inv_w
+        int x_min, x_max, y_min, y_max; // pixel bounding box, clamped to the screen
+        depth_t depth_min, depth_max;
+        double alpha_denominator, beta_denominator;
+        // Integer edge functions of the vertices snapped to 1/subpixel, in 1/subpixel^2 units: edge i is the one
+        // opposite vertex i, positive inside, given at the center of pixel (0, 0) and stepped per pixel. A sample is
+        // covered when all three are >= 0; edges that are not top-left are biased by -1, so a sample exactly on an
+        // edge shared by two triangles belongs to only one of them.
+        std::int64_t edge[3], edge_dx[3], edge_dy[3];
+        int edge_bias[3];
+        double depth_weight[3]; // vertex depth over twice the area, edge i weighs the depth of vertex i
+        double z_dx, z_dy;      // depth step per pixel
+
+        // edge values at the center of pixel (x, y)
+        void edges_at(int x, int y, std::int64_t e[3]) const {
+            for (int i = 0; i < 3; i++) e[i] = edge[i] + x * edge_dx[i] + y * edge_dy[i];
+        }
+        // interpolated depth where the edges take the values e, exact up to the rounding of the products
+        [[nodiscard]] double depth_at(const std::int64_t e[3]) const {
+            double z = 0;
+            for (int i = 0; i < 3; i++) z += static_cast<double>(e[i] + edge_bias[i]) * depth_weight[i];
+            return z;
+        }
+    };
+    static constexpr int tile_size = 64;
+    static constexpr int hiz_block_size = 8; // coarse depth granularity, a block never straddles two tiles
+    static constexpr int tile_blocks = tile_size / hiz_block_size;
+    static_assert(tile_size % hiz_block_size == 0);
+    static constexpr int max_samples = 8;
+    // vertices snap to 1/subpixel of a pixel, and triangles are clipped to guard_band pixels around the screen:
+    // with width and height up to 16384, edge functions stay within 50 bits
+    static constexpr int subpixel = 256;
+    static constexpr double guard_band = 16384;
+    // outcode bits of a vertex against the clip volume; Guard is outside the guard band, on any side
+    enum Outcode : std::uint8_t { Left = 1, Right = 2, Bottom = 4, Top = 8, Near = 16, Guard = 32 };
+    // coarse depth classification of a block against the triangle being filled
+    enum BlockState : std::uint8_t { Test, Occluded, Visible };
+    // part of a triangle to fill, within a single tile
+    struct FillRegion {
+        int x_min, x_max, y_min, y_max;
+        int bx_min, by_min;
+        const BlockState (*block_state)[tile_blocks];
+        int tile;
+    };
+    // stand in for the shader in the geometry pass of draw_deferred and in draw_depth
+    struct VisibilityPass {};
+    struct DepthPass {
+        struct Varyings {};
+        Varyings vertex(int, const Instance&) const { return {}; }
+    };
+
     [[nodiscard]] int get_index(int x, int y) const { return x + y * width; }
-    void rasterize_triangle(vec4 v4s[], vec3 color);
+    [[nodiscard]] std::uint8_t outcode(const vec4& v) const {
+        // -w <= x, y <= w once the viewport is folded in
+        std::uint8_t code = 0;
+        if (v.x < 0) code |= Left;
+        if (v.x > width * v.w) code |= Right;
+        if (v.y < 0) code |= Bottom;
+        if (v.y > height * v.w) code |= Top;
+        if (v.w < near_w) code |= Near;
+        return code;
+    }
+    [[nodiscard]] bool beyond_guard_band(const vec4& v) const {
+        return v.x < -guard_band * v.w || v.x > (width + guard_band) * v.w ||
+               v.y < -guard_band * v.w || v.y > (height + guard_band) * v.w;
+    }
+    bool box_visible(const AABB& box, const mat4& mvp);
+    [[nodiscard]] int select_lod(const Mesh& mesh, const mat4& mvp) const;
+    void collect_vertex_ranges(const Mesh& mesh, size_t first_cluster);
+    void process_vertices(const Mesh& mesh, const mat4& mvp, int first, int begin, int end);
+    void assemble_triangles(const Mesh& mesh);
+    void clip_triangle(const int idx[3], int face, int instance);
+    void emit_triangle(const vec3 v3s[3], const double w[3], const double* varyings[3], int face, int instance);
+    bool setup_triangle(const vec3 v3s[3], Triangle& tri) const;
+    void bin_triangles();
+    bool classify_blocks(const Triangle& tri, int x_min, int x_max, int y_min, int y_max,
+                         BlockState block_state[tile_blocks][tile_blocks]);
+    template<typename Shader> void rasterize_tile(const Shader& shader, int tile);
+    template<typename Shader> void rasterize_triangle(const Shader& shader, const Triangle& tri, int x_min, int x_max, int y_min, int y_max);
+    template<typename Shader> void fill_scalar(const Shader& shader, const Triangle& tri, const FillRegion& region);
+    template<typename Shader> void fill_sse2(const Shader& shader, const Triangle& tri, const FillRegion& region);
+    template<typename Shader> void fill_avx2(const Shader& shader, const Triangle& tri, const FillRegion& region);
+    template<typename Shader> void fill_msaa(const Shader& shader, const Triangle& tri, const FillRegion& region);
+    template<typename Shader> void prepare_draw(const Mesh& mesh, std::span<const mat4> models, const Shader& shader);
+    template<typename Shader> void rasterize_tiles(const Shader& shader);
+    template<typename Shader> void resolve(const Shader& shader);
+    template<typename Shader> bool shade(const Shader& shader, const Triangle& tri, int x, int y, TGAColor& color) const {
+        return shade_at(shader, tri, x, y, x + .5, y + .5, color);
+    }
+    // varyings are interpolated at (px, py), somewhere in pixel (x, y)
+    template<typename Shader> bool shade_at(const Shader& shader, const Triangle& tri, int x, int y, double px, double py,
+                                            TGAColor& color) const;
+    // true when the pixel was written
+    template<typename Shader> bool shade_pixel(const Shader& shader, const Triangle& tri, int x, int y, depth_t depth);
+    bool shade_pixel(const DepthPass&, const Triangle&, int x, int y, depth_t depth) {
+        z_buffer[get_index(x, y)] = depth;
+        hiz_dirty[x / hiz_block_size + y / hiz_block_size * blocks_x] = 1;
+        return true;
+    }
+    bool shade_pixel(const VisibilityPass&, const Triangle& tri, int x, int y, depth_t depth) {
+        g_buffer[get_index(x, y)] = static_cast<std::int32_t>(&tri - triangles.data());
+        z_buffer[get_index(x, y)] = depth;
+        hiz_dirty[x / hiz_block_size + y / hiz_block_size * blocks_x] = 1;
+        return true;
+    }
+    void write_pixel(int x, int y, std::uint32_t color, depth_t depth) {
+        color_buffer[get_index(x, y)] = color;
+        z_buffer[get_index(x, y)] = depth;
+        hiz_dirty[x / hiz_block_size + y / hiz_block_size * blocks_x] = 1;
+    }
+    void update_hiz_block(int block);
+    // MSAA: color of the samples in mask of a pixel of tile
+    void write_samples(int tile, int pixel, std::uint32_t color, int mask);
+    [[nodiscard]] std::uint32_t resolve_samples(int pixel) const;
+#ifdef MR_INSTRUMENT
+    // a pixel of tile passed the depth test and was written, only the thread filling tile touches its counters and pixels
+    void count_pass(int tile, int x, int y) {
+        std::uint16_t& passes = overdraw[get_index(x, y)];
+        tile_counters[tile].pixels_passed++;
+        if (passes) tile_counters[tile].pixels_overdrawn++;
+        if (passes < std::numeric_limits<std::uint16_t>::max()) passes++;
+    }
+    void merge_tile_counters();
+#endif
 private:
-    mat4 model, view, projection, viewport;
+    mat4 view, projection, viewport;
+    CullMode cull_mode;
+    FillKernel fill_kernel;
+    double near_w;
+    double lod_error;
+    int samples; // per pixel, 1 without MSAA
+    StageTimes stage_times;
+    PipelineCounters counters;
+#ifdef MR_INSTRUMENT
+    std::vector<PipelineCounters> tile_counters; // pixel counts of the fill in progress, merged into counters after it
+    std::vector<std::uint16_t> overdraw; // depth test passes per pixel, saturating
+#endif
     int width, height;
-    std::vector<vec3> vertices;
-    std::vector<int> indices; // each 3 int is a triangle
+    // vertices of the current draw after viewport * projection * view * model, one per mesh vertex and instance;
+    // the viewport is applied before the divide so clip_vertices stay homogeneous and screen_vertices = clip_vertices.to_vec3()
+    std::vector<vec4> clip_vertices;
+    std::vector<vec3> screen_vertices; // only valid when the vertex is not outside the near plane
+    std::vector<std::uint8_t> outcodes;
+    // (instance, cluster) pairs that survived culling, only their vertices and faces are processed
+    std::vector<std::pair<int, int>> visible_clusters;
+    std::vector<std::pair<int, int>> vertex_ranges; // [begin, end) of the vertices the last instance's clusters use
+    int varying_count; // doubles per vertex in the current draw
+    std::vector<double> vertex_varyings; // varying_count per clip_vertices entry
+    std::vector<double> clip_varyings; // varyings of the vertices created by clipping
+#ifdef MR_FLOAT_VERTEX_STAGE
+    std::vector<vec4f> float_clip_vertices; // output of transform_points
+#endif
+    std::vector<Triangle> triangles; // set up triangles in submission order
+    std::vector<double> triangle_varyings;
+    int tiles_x, tiles_y;
+    std::vector<std::vector<int>> tile_bins; // triangle ids overlapping each tile, in submission order
+
+    // render targets, 8 bytes per pixel: BGRA in TGA byte order and depth_t
+    std::vector<std::uint32_t> color_buffer;
+    std::vector<depth_t> z_buffer;
+    // MSAA only: the depth of every sample, samples per pixel, while z_buffer holds the farthest of them for the hi-z.
+    // Colors are compressed: a pixel whose samples all went to one triangle keeps its color in color_buffer alone,
+    // the others own a slot of samples colors in the sample_slots of their tile, so tiles still fill independently
+    std::vector<depth_t> sample_depth;
+    std::vector<std::int32_t> sample_slot; // slot of every pixel, -1 while its samples share color_buffer's color
+    struct SampleSlots {
+        std::vector<std::uint32_t> colors;
+        std::vector<std::int32_t> free;
+    };
+    std::vector<SampleSlots> sample_slots;
+    // draw_deferred only: id in triangles of the nearest triangle so far, -1 where the draw left the pixel untouched
+    std::vector<std::int32_t> g_buffer;
 
-    std::vector<double> z_buffer;
-    std::vector<vec3> framebuffer;
+    // hierarchical z: conservative farthest/nearest depth of every hiz_block_size^2 block of z_buffer,
+    // refreshed lazily from z_buffer the next time a dirty block is queried
+    int blocks_x, blocks_y;
+    std::vector<depth_t> hiz_far, hiz_near;
+    std::vector<std::uint8_t> hiz_dirty;
 };
 
+#include "Rasterizer_draw.h"
+
 #endif //RASTERIZER_H
@@ -0,0 +1,621 @@
+//
+// Created by laoe on 25-9-26.
+//
+
+// Shader specialised part of the pipeline, included at the end of Rasterizer.h: the per-vertex and per-pixel
+// loops are instantiated for every shader type so its stages inline into them.
+
+#ifndef RASTERIZER_DRAW_H
+#define RASTERIZER_DRAW_H
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+#include "Rasterizer.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define MR_FILL_X86
+#endif
+
+namespace rasterizer_detail {
+
+// adds the time since start to total and restarts start, for Rasterizer::StageTimes; the span also goes to the trace
+inline void lap(std::chrono::steady_clock::time_point& start, double& total, [[maybe_unused]] const char* name) {
+    const auto now = std::chrono::steady_clock::now();
+    total += std::chrono::duration<double>(now - start).count();
+    MR_INSTRUMENT_ONLY(instrument::record(name, start, now);)
+    start = now;
+}
+
+#ifdef MR_DEPTH_INT24
+// The middle half of the 24-bit range is fixed point over z in [-1, 1]. The quarters below and above it hold
+// |z| in [1, 2^32) by the bits of its float, 5 exponent and 17 mantissa bits, so geometry outside the depth range
+// of the projection keeps its order instead of being clamped together.
+constexpr depth_t depth_linear = 1 << 22; // first code of the fixed point part
+constexpr double depth_scale = ((1 << 23) - 1) / 2.;
+constexpr std::uint32_t depth_one_bits = 0x3F800000; // bits of 1.f
+// monotonic, so comparing encoded depths never reorders two fragments
+inline depth_t encode_depth(double z) {
+    if (z >= -1. && z <= 1.)
+        return depth_linear + static_cast<depth_t>((z + 1.) * depth_scale);
+    const float magnitude = static_cast<float>(std::min(std::abs(z), 0x1p32));
+    const depth_t offset = std::min<std::uint32_t>((std::bit_cast<std::uint32_t>(magnitude) - depth_one_bits) >> 6,
+                                                   depth_linear - 1);
+    return z > 0 ? 3 * depth_linear + offset : depth_linear - 1 - offset;
+}
+inline double decode_depth(depth_t depth) {
+    if (depth >= depth_linear && depth < 3 * depth_linear)
+        return (depth - depth_linear) / depth_scale - 1.;
+    const bool above = depth >= 3 * depth_linear;
+    const std::uint32_t offset = above ? depth - 3 * depth_linear : depth_linear - 1 - depth;
+    const double magnitude = std::bit_cast<float>(depth_one_bits + (offset << 6));
+    return above ? magnitude : -magnitude;
+}
+#else
+inline depth_t encode_depth(double z) { return static_cast<float>(z); }
+inline double decode_depth(depth_t depth) { return depth; }
+#endif
+
+// standard MSAA sample positions, relative to the pixel center
+struct SampleOffset {
+    double x, y;
+};
+constexpr SampleOffset sample_pattern_2[] = {{4 / 16., 4 / 16.}, {-4 / 16., -4 / 16.}};
+constexpr SampleOffset sample_pattern_4[] = {{-2 / 16., -6 / 16.}, {6 / 16., -2 / 16.}, {-6 / 16., 2 / 16.}, {2 / 16., 6 / 16.}};
+constexpr SampleOffset sample_pattern_8[] = {{1 / 16., -3 / 16.}, {-1 / 16., 3 / 16.}, {5 / 16., 1 / 16.}, {-3 / 16., -5 / 16.},
+                                             {-5 / 16., 5 / 16.}, {-7 / 16., -1 / 16.}, {3 / 16., 7 / 16.}, {7 / 16., -7 / 16.}};
+inline const SampleOffset* sample_pattern(int samples) {
+    return samples == 8 ? sample_pattern_8 : samples == 4 ? sample_pattern_4 : sample_pattern_2;
+}
+
+// rounds towards negative infinity, unlike /
+inline std::int64_t floor_div(std::int64_t a, std::int64_t b) {
+    const std::int64_t q = a / b;
+    return a % b != 0 && (a < 0) != (b < 0) ? q - 1 : q;
+}
+
+inline std::uint32_t pack_color(const TGAColor& c) {
+    std::uint32_t packed;
+    memcpy(&packed, c.bgra, sizeof(packed));
+    return packed;
+}
+
+// doubles per vertex a shader's varyings occupy, they are interpolated as a flat array
+template<typename Varyings> constexpr int varying_count() {
+    static_assert(std::is_trivially_copyable_v<Varyings>, "varyings are copied around as raw doubles");
+    if constexpr (std::is_empty_v<Varyings>) {
+        return 0;
+    } else {
+        static_assert(sizeof(Varyings) % sizeof(double) == 0, "varyings must be made of doubles only");
+        return sizeof(Varyings) / sizeof(double);
+    }
+}
+
+#ifdef MR_FILL_X86
+
+#ifdef MR_DEPTH_INT24
+// lanes outside [-1, 1] leave the fixed point part of the encoding, the vector kernels hand them over to this
+inline int depth_test_scalar(const double* z, int lanes, const depth_t* buffer, depth_t depth[4]) {
+    int nearer = 0;
+    for (int i = 0; i < lanes; i++) {
+        depth[i] = encode_depth(z[i]);
+        if (depth[i] > buffer[i]) nearer |= 1 << i;
+    }
+    return nearer;
+}
+#endif
+
+// encodes the depth of every lane into depth[] and returns the mask of lanes nearer than buffer[]; only the first
+// readable entries of buffer[] are loaded, the rest may belong to a tile another thread is writing
+__attribute__((target("sse2")))
+inline int depth_test_sse2(__m128d z, const depth_t* buffer, int readable, depth_t depth[4]) {
+#ifdef MR_DEPTH_INT24
+    const __m128d abs_z = _mm_and_pd(z, _mm_castsi128_pd(_mm_set1_epi64x(0x7FFFFFFFFFFFFFFFll)));
+    if (_mm_movemask_pd(_mm_cmpgt_pd(abs_z, _mm_set1_pd(1.)))) {
+        alignas(16) double lanes[2];
+        _mm_store_pd(lanes, z);
+        return depth_test_scalar(lanes, readable, buffer, depth);
+    }
+    const __m128d scaled = _mm_min_pd(_mm_max_pd(_mm_mul_pd(_mm_add_pd(z, _mm_set1_pd(1.)), _mm_set1_pd(depth_scale)),
+                                                 _mm_setzero_pd()), _mm_set1_pd(2. * depth_scale));
+    const __m128i encoded = _mm_add_epi32(_mm_cvttpd_epi32(scaled), _mm_set1_epi32(depth_linear));
+    _mm_store_si128(reinterpret_cast<__m128i*>(depth), encoded);
+    const __m128i stored = readable > 1 ? _mm_loadl_epi64(reinterpret_cast<const __m128i*>(buffer))
+                                        : _mm_cvtsi32_si128(static_cast<int>(buffer[0]));
+    return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(encoded, stored))) & ((1 << readable) - 1);
+#else
+    const __m128 encoded = _mm_cvtpd_ps(z);
+    _mm_store_ps(depth, encoded);
+    const __m128 stored = readable > 1 ? _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(buffer))) : _mm_load_ss(buffer);
+    return _mm_movemask_ps(_mm_cmpgt_ps(encoded, stored)) & ((1 << readable) - 1);
+#endif
+}
+
+__attribute__((target("avx2")))
+inline int depth_test_avx2(__m256d z, const depth_t* buffer, int readable, depth_t depth[4]) {
+    // lanes at or past readable are masked off the load and never touch memory
+    const __m128i load_mask = _mm_cmpgt_epi32(_mm_set1_epi32(readable), _mm_setr_epi32(0, 1, 2, 3));
+#ifdef MR_DEPTH_INT24
+    const __m256d abs_z = _mm256_and_pd(z, _mm256_castsi256_pd(_mm256_set1_epi64x(0x7FFFFFFFFFFFFFFFll)));
+    if (_mm256_movemask_pd(_mm256_cmp_pd(abs_z, _mm256_set1_pd(1.), _CMP_GT_OQ))) {
+        alignas(32) double lanes[4];
+        _mm256_store_pd(lanes, z);
+        return depth_test_scalar(lanes, readable, buffer, depth);
+    }
+    const __m256d scaled = _mm256_min_pd(_mm256_max_pd(_mm256_mul_pd(_mm256_add_pd(z, _mm256_set1_pd(1.)), _mm256_set1_pd(depth_scale)),
+                                                       _mm256_setzero_pd()), _mm256_set1_pd(2. * depth_scale));
+    const __m128i encoded = _mm_add_epi32(_mm256_cvttpd_epi32(scaled), _mm_set1_epi32(depth_linear));
+    _mm_store_si128(reinterpret_cast<__m128i*>(depth), encoded);
+    const __m128i stored = _mm_maskload_epi32(reinterpret_cast<const int*>(buffer), load_mask);
+    return _mm_movemask_ps(_mm_castsi128_ps(_mm_and_si128(_mm_cmpgt_epi32(encoded, stored), load_mask)));
+#else
+    const __m128 encoded = _mm256_cvtpd_ps(z);
+    _mm_store_ps(depth, encoded);
+    const __m128 stored = _mm_maskload_ps(buffer, load_mask);
+    return _mm_movemask_ps(_mm_and_ps(_mm_cmpgt_ps(encoded, stored), _mm_castsi128_ps(load_mask)));
+#endif
+}
+
+#endif
+
+}
+
+template<typename Shader>
+void Rasterizer::draw(const Mesh& mesh, std::span<const mat4> models, const Shader& shader) {
+    prepare_draw(mesh, models, shader);
+    auto start = std::chrono::steady_clock::now();
+    rasterize_tiles(shader);
+    rasterizer_detail::lap(start, stage_times.fill, "fill");
+    triangles.clear();
+    triangle_varyings.clear();
+}
+
+template<typename Shader>
+void Rasterizer::draw_deferred(const Mesh& mesh, std::span<const mat4> models, const Shader& shader) {
+    if (samples > 1) {
+        // the visibility pass keeps one triangle per pixel, not per sample
+        draw(mesh, models, shader);
+        return;
+    }
+    prepare_draw(mesh, models, shader);
+    auto start = std::chrono::steady_clock::now();
+    g_buffer.assign(width * height, -1);
+    rasterize_tiles(VisibilityPass{});
+    rasterizer_detail::lap(start, stage_times.fill, "fill");
+    resolve(shader);
+    rasterizer_detail::lap(start, stage_times.resolve, "resolve");
+    triangles.clear();
+    triangle_varyings.clear();
+}
+
+inline double Rasterizer::get_depth(int x, int y) const {
+    return rasterizer_detail::decode_depth(z_buffer[get_index(x, y)]);
+}
+
+// level of detail selection, culling, vertex stage, primitive assembly and binning of every instance
+template<typename Shader>
+void Rasterizer::prepare_draw(const Mesh& mesh, std::span<const mat4> models, const Shader& shader) {
+    using Varyings = typename Shader::Varyings;
+    constexpr int n = rasterizer_detail::varying_count<Varyings>();
+    const int nvertex = mesh.vertex_count();
+    const size_t total = static_cast<size_t>(nvertex) * models.size();
+    clip_vertices.resize(total);
+    screen_vertices.resize(total);
+    outcodes.resize(total);
+    varying_count = n;
+    vertex_varyings.resize(total * n);
+    visible_clusters.clear();
+    auto start = std::chrono::steady_clock::now();
+    for (int id = 0; id < static_cast<int>(models.size()); id++) {
+        // the whole instance, then every cluster: what is culled gets no vertex work at all
+        const mat4 mvp = viewport * projection * view * models[id];
+        if (!box_visible(mesh.bounds, mvp)) {
+            MR_INSTRUMENT_ONLY(counters.triangles_submitted += mesh.lods[0].face_count;
+                               counters.triangles_culled += mesh.lods[0].face_count;)
+            continue;
+        }
+        const Mesh::Lod& lod = mesh.lods[select_lod(mesh, mvp)];
+        MR_INSTRUMENT_ONLY(counters.triangles_submitted += lod.face_count;)
+        const size_t first_cluster = visible_clusters.size();
+        for (int c = lod.first_cluster; c < lod.first_cluster + lod.cluster_count; c++) {
+            if (box_visible(mesh.clusters[c].box, mvp)) {
+                visible_clusters.emplace_back(id, c);
+                continue;
+            }
+            MR_INSTRUMENT_ONLY(counters.triangles_culled += mesh.clusters[c].face_count;)
+        }
+        collect_vertex_ranges(mesh, first_cluster);
+
+        Instance instance {id, models[id], {}};
+        if constexpr (n > 0) instance.normal = models[id].invert().transpose();
+        double* out = vertex_varyings.data() + static_cast<size_t>(id) * nvertex * n;
+        for (auto [begin, end] : vertex_ranges) {
+            process_vertices(mesh, mvp, id * nvertex, begin, end);
+            for (int i = begin; i < end; i++) {
+                const Varyings v = shader.vertex(i, instance);
+                if constexpr (n > 0) memcpy(out + static_cast<size_t>(i) * n, &v, sizeof(v));
+            }
+        }
+    }
+    rasterizer_detail::lap(start, stage_times.vertex, "vertex");
+    assemble_triangles(mesh);
+    bin_triangles();
+    rasterizer_detail::lap(start, stage_times.setup, "setup");
+}
+
+template<typename Shader>
+void Rasterizer::rasterize_tiles(const Shader& shader) {
+    // every tile owns its part of color_buffer/z_buffer and walks its bin in submission order,
+    // so no synchronisation is needed and the result matches a serial run
+    const int ntile = tiles_x * tiles_y;
+#pragma omp parallel for schedule(dynamic)
+    for (int tile = 0; tile < ntile; tile++) {
+        MR_TRACE_SCOPE("tile");
+        rasterize_tile(shader, tile);
+    }
+    MR_INSTRUMENT_ONLY(merge_tile_counters();)
+}
+
+// deferred shading: every pixel whose triangle survived the geometry pass is shaded exactly once
+template<typename Shader>
+void Rasterizer::resolve(const Shader& shader) {
+#pragma omp parallel for schedule(dynamic, 8)
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const std::int32_t id = g_buffer[get_index(x, y)];
+            TGAColor color;
+            if (id >= 0 && shade(shader, triangles[id], x, y, color))
+                color_buffer[get_index(x, y)] = rasterizer_detail::pack_color(color);
+        }
+    }
+}
+
+template<typename Shader>
+void Rasterizer::rasterize_tile(const Shader& shader, int tile) {
+    const int tile_x_min = tile % tiles_x * tile_size, tile_y_min = tile / tiles_x * tile_size;
+    const int tile_x_max = std::min(tile_x_min + tile_size, width) - 1;
+    const int tile_y_max = std::min(tile_y_min + tile_size, height) - 1;
+    for (int i : tile_bins[tile]) {
+        const Triangle& tri = triangles[i];
+        rasterize_triangle(shader, tri, std::max(tri.x_min, tile_x_min), std::min(tri.x_max, tile_x_max),
+                                        std::max(tri.y_min, tile_y_min), std::min(tri.y_max, tile_y_max));
+    }
+}
+
+// fills the part of tri inside [x_min, x_max] x [y_min, y_max], a region that lies within a single tile
+template<typename Shader>
+void Rasterizer::rasterize_triangle(const Shader& shader, const Triangle& tri, int x_min, int x_max, int y_min, int y_max) {
+    BlockState block_state[tile_blocks][tile_blocks];
+    if (!classify_blocks(tri, x_min, x_max, y_min, y_max, block_state))
+        return;
+
+    const FillRegion region {x_min, x_max, y_min, y_max, x_min / hiz_block_size, y_min / hiz_block_size, block_state,
+                             x_min / tile_size + y_min / tile_size * tiles_x};
+    if constexpr (!std::is_same_v<Shader, VisibilityPass>) {
+        if (samples > 1) {
+            fill_msaa(shader, tri, region);
+            return;
+        }
+    }
+    switch (fill_kernel) {
+        case FillKernel::AVX2: fill_avx2(shader, tri, region); break;
+        case FillKernel::SSE2: fill_sse2(shader, tri, region); break;
+        default: fill_scalar(shader, tri, region); break;
+    }
+}
+
+// interpolates the varyings of tri at (px, py), the center of pixel (x, y) unless MSAA moves it, and runs the
+// fragment stage on them, with their derivatives if it takes them
+template<typename Shader>
+bool Rasterizer::shade_at(const Shader& shader, const Triangle& tri, int x, int y, double px, double py, TGAColor& color) const {
+    using Varyings = typename Shader::Varyings;
+    constexpr int n = rasterizer_detail::varying_count<Varyings>();
+    constexpr bool wants_gradients = requires(const Varyings& in, const Fragment& frag, const Gradients<Varyings>& d, TGAColor& c) {
+        shader.fragment(in, frag, d, c);
+    };
+    const Fragment frag {x, y, tri.face, tri.instance};
+    Varyings in {};
+    [[maybe_unused]] Gradients<Varyings> gradients {};
+    if constexpr (n > 0) {
+        // screen-space barycentrics weighted by 1/w give the perspective-correct ones
+        const vec3* v3s = tri.v3s;
+        const double alpha = (- (px - v3s[1].x) * (v3s[2].y - v3s[1].y) + (py - v3s[1].y) * (v3s[2].x - v3s[1].x)) / tri.alpha_denominator;
+        const double beta = (- (px - v3s[2].x) * (v3s[0].y - v3s[2].y) + (py - v3s[2].y) * (v3s[0].x - v3s[2].x)) / tri.beta_denominator;
+        const double gamma = 1. - alpha - beta;
+        const double w = 1. / (alpha * tri.inv_w[0] + beta * tri.inv_w[1] + gamma * tri.inv_w[2]);
+        const double* v = &triangle_varyings[tri.varyings];
+        double interpolated[n];
+        for (int k = 0; k < n; k++)
+            interpolated[k] = (alpha * v[k] + beta * v[n + k] + gamma * v[2 * n + k]) * w;
+        memcpy(&in, interpolated, sizeof(in));
+        if constexpr (wants_gradients) {
+            // quotient rule on sum(b * v / w) / sum(b / w), the screen-space barycentrics b step by the edges
+            const double scale = 1. / (std::abs(tri.alpha_denominator) * subpixel * subpixel);
+            double b_dx[3], b_dy[3];
+            for (int i = 0; i < 3; i++) b_dx[i] = tri.edge_dx[i] * scale, b_dy[i] = tri.edge_dy[i] * scale;
+            const double inv_w_dx = b_dx[0] * tri.inv_w[0] + b_dx[1] * tri.inv_w[1] + b_dx[2] * tri.inv_w[2];
+            const double inv_w_dy = b_dy[0] * tri.inv_w[0] + b_dy[1] * tri.inv_w[1] + b_dy[2] * tri.inv_w[2];
+            double dx[n], dy[n];
+            for (int k = 0; k < n; k++) {
+                dx[k] = (b_dx[0] * v[k] + b_dx[1] * v[n + k] + b_dx[2] * v[2 * n + k] - interpolated[k] * inv_w_dx) * w;
+                dy[k] = (b_dy[0] * v[k] + b_dy[1] * v[n + k] + b_dy[2] * v[2 * n + k] - interpolated[k] * inv_w_dy) * w;
+            }
+            memcpy(&gradients.dx, dx, sizeof(dx));
+            memcpy(&gradients.dy, dy, sizeof(dy));
+        }
+    }
+    if constexpr (wants_gradients)
+        return shader.fragment(in, frag, gradients, color);
+    else
+        return shader.fragment(in, frag, color);
+}
+
+// forward shading of a pixel that passed the depth test, false when the fragment stage discarded it
+template<typename Shader>
+bool Rasterizer::shade_pixel(const Shader& shader, const Triangle& tri, int x, int y, depth_t depth) {
+    TGAColor color;
+    if (!shade(shader, tri, x, y, color))
+        return false;
+    write_pixel(x, y, rasterizer_detail::pack_color(color), depth);
+    return true;
+}
+
+template<typename Shader>
+void Rasterizer::fill_scalar(const Shader& shader, const Triangle& tri, const FillRegion& region) {
+    using rasterizer_detail::encode_depth;
+    std::int64_t row[3];
+    tri.edges_at(region.x_min, region.y_min, row);
+
+    for (int y = region.y_min; y <= region.y_max; y++) {
+        const BlockState* row_state = region.block_state[y / hiz_block_size - region.by_min];
+        std::int64_t e0 = row[0], e1 = row[1], e2 = row[2];
+        double z = tri.depth_at(row);
+        for (int i = 0; i < 3; i++) row[i] += tri.edge_dy[i];
+        bool entered = false;
+        for (int x = region.x_min; x <= region.x_max; ) {
+            const int bx = x / hiz_block_size;
+            const BlockState state = row_state[bx - region.bx_min];
+            if (state == Occluded) {
+                const int skip = std::min((bx + 1) * hiz_block_size - 1, region.x_max) - x + 1;
+                x += skip, z += skip * tri.z_dx;
+                e0 += skip * tri.edge_dx[0], e1 += skip * tri.edge_dx[1], e2 += skip * tri.edge_dx[2];
+                continue;
+            }
+
+            const int px = x;
+            const bool covered = (e0 | e1 | e2) >= 0;
+            const depth_t depth = encode_depth(z);
+            x++, z += tri.z_dx;
+            e0 += tri.edge_dx[0], e1 += tri.edge_dx[1], e2 += tri.edge_dx[2];
+            if (!covered) {
+                if (entered) break; // the triangle is convex, once left the row has no more pixels
+                continue;
+            }
+            entered = true;
+            MR_INSTRUMENT_ONLY(tile_counters[region.tile].pixels_tested++;)
+
+            if ((state == Visible || depth > z_buffer[get_index(px, y)]) && shade_pixel(shader, tri, px, y, depth)) {
+                MR_INSTRUMENT_ONLY(count_pass(region.tile, px, y);)
+            }
+        }
+    }
+}
+
+// Multi-sample fill: coverage and depth at every sample of the pattern, the fragment stage once for the pixel if
+// any sample passed, and its color to those samples only. It is shaded at the pixel center when the triangle covers
+// it and at a covered sample otherwise, so edge pixels never extrapolate the varyings. Every row only visits the
+// span where some sample can be covered, widened by how far the samples reach across each edge; Visible blocks are
+// still tested because the hi-z only knows the farthest sample of every pixel.
+template<typename Shader>
+void Rasterizer::fill_msaa(const Shader& shader, const Triangle& tri, const FillRegion& region) {
+    using rasterizer_detail::encode_depth;
+    const rasterizer_detail::SampleOffset* pattern = rasterizer_detail::sample_pattern(samples);
+    // edges and depth of every sample relative to the pixel center; the pattern is in 1/16 of a pixel and the
+    // edge steps are multiples of subpixel, so the edge offsets are exact
+    static_assert(subpixel % 16 == 0);
+    std::int64_t edge_offset[max_samples][3], reach[3] = {};
+    double z_offset[max_samples];
+    for (int s = 0; s < samples; s++) {
+        const std::int64_t sx = std::llround(pattern[s].x * 16), sy = std::llround(pattern[s].y * 16);
+        for (int i = 0; i < 3; i++) {
+            edge_offset[s][i] = (sx * tri.edge_dx[i] + sy * tri.edge_dy[i]) / 16;
+            reach[i] = std::max(reach[i], std::abs(edge_offset[s][i]));
+        }
+        z_offset[s] = pattern[s].x * tri.z_dx + pattern[s].y * tri.z_dy;
+    }
+    const int full = (1 << samples) - 1;
+    const int count = region.x_max - region.x_min + 1;
+    // narrows [first, last] to the pixels i of the row where e + i * e_dx >= -reach
+    auto clip_span = [count](std::int64_t e, std::int64_t e_dx, std::int64_t reach, int& first, int& last) {
+        const std::int64_t limit = -reach - e;
+        if (e_dx > 0) first = static_cast<int>(std::clamp<std::int64_t>(-rasterizer_detail::floor_div(-limit, e_dx), first, count));
+        else if (e_dx < 0) last = static_cast<int>(std::clamp<std::int64_t>(rasterizer_detail::floor_div(limit, e_dx), -1, last));
+        else if (limit > 0) last = -1;
+    };
+    std::int64_t row[3];
+    tri.edges_at(region.x_min, region.y_min, row);
+
+    for (int y = region.y_min; y <= region.y_max; y++) {
+        int first = 0, last = count - 1;
+        for (int i = 0; i < 3; i++) clip_span(row[i], tri.edge_dx[i], reach[i], first, last);
+        const BlockState* row_state = region.block_state[y / hiz_block_size - region.by_min];
+        std::int64_t e[3];
+        for (int i = 0; i < 3; i++) e[i] = row[i] + first * tri.edge_dx[i];
+        double z_center = tri.depth_at(row) + first * tri.z_dx;
+        for (int i = 0; i < 3; i++) row[i] += tri.edge_dy[i];
+        for (int x = region.x_min + first; x <= region.x_min + last; x++, z_center += tri.z_dx) {
+            const std::int64_t e0 = e[0], e1 = e[1], e2 = e[2];
+            for (int i = 0; i < 3; i++) e[i] += tri.edge_dx[i];
+            if (row_state[x / hiz_block_size - region.bx_min] == Occluded) continue;
+
+            const int pixel = get_index(x, y);
+            depth_t* stored = &sample_depth[static_cast<size_t>(pixel) * samples];
+            int covered = full, passed = 0;
+            if (e0 < reach[0] || e1 < reach[1] || e2 < reach[2]) {
+                // near an edge, only then do the samples need their own coverage test
+                covered = 0;
+                for (int s = 0; s < samples; s++) {
+                    if (((e0 + edge_offset[s][0]) | (e1 + edge_offset[s][1]) | (e2 + edge_offset[s][2])) >= 0) covered |= 1 << s;
+                }
+            }
+            depth_t depth[max_samples];
+            for (int s = 0; s < samples; s++) {
+                depth[s] = encode_depth(z_center + z_offset[s]);
+                if (depth[s] > stored[s]) passed |= 1 << s;
+            }
+            passed &= covered;
+            if (!covered) continue;
+            MR_INSTRUMENT_ONLY(tile_counters[region.tile].pixels_tested++;)
+            if (!passed) continue;
+
+            if constexpr (!std::is_same_v<Shader, DepthPass>) {
+                double px = x + .5, py = y + .5;
+                if ((e0 | e1 | e2) < 0) {
+                    const int s = __builtin_ctz(passed);
+                    px += pattern[s].x, py += pattern[s].y;
+                }
+                TGAColor color;
+                if (!shade_at(shader, tri, x, y, px, py, color))
+                    continue; // discarded, neither color nor depth is written
+                write_samples(region.tile, pixel, rasterizer_detail::pack_color(color), passed);
+            }
+            MR_INSTRUMENT_ONLY(count_pass(region.tile, x, y);)
+            depth_t farthest = depth[__builtin_ctz(passed)];
+            for (int s = 0; s < samples; s++) {
+                if (passed >> s & 1) stored[s] = depth[s];
+                farthest = std::min(farthest, stored[s]);
+            }
+            z_buffer[pixel] = farthest;
+            hiz_dirty[x / hiz_block_size + y / hiz_block_size * blocks_x] = 1;
+        }
+    }
+}
+
+#ifdef MR_FILL_X86
+
+// The vector kernels evaluate aligned spans of 2 (SSE2) or 4 (AVX2) pixels at once: coverage mask, interpolated
+// depth and depth test happen in registers, the surviving lanes are then shaded one by one. Spans are aligned so
+// they never straddle a hi-z block or a tile; the depth buffer is only read up to the end of the region, the pixels
+// past it can belong to the neighbouring tile.
+
+template<typename Shader>
+__attribute__((target("sse2")))
+void Rasterizer::fill_sse2(const Shader& shader, const Triangle& tri, const FillRegion& region) {
+    constexpr int lanes = 2;
+    const int x_first = region.x_min & ~(lanes - 1);
+    std::int64_t row[3];
+    tri.edges_at(x_first, region.y_min, row);
+
+    // lane i is i pixels to the right of the span start, the edge products fit 64 bit lanes
+    __m128i edge_lane[3], edge_span[3];
+    for (int i = 0; i < 3; i++) {
+        edge_lane[i] = _mm_set_epi64x(tri.edge_dx[i], 0);
+        edge_span[i] = _mm_set1_epi64x(lanes * tri.edge_dx[i]);
+    }
+    const __m128d z_lane = _mm_mul_pd(_mm_set_pd(1, 0), _mm_set1_pd(tri.z_dx));
+
+    for (int y = region.y_min; y <= region.y_max; y++) {
+        const BlockState* row_state = region.block_state[y / hiz_block_size - region.by_min];
+        __m128i e0 = _mm_add_epi64(_mm_set1_epi64x(row[0]), edge_lane[0]);
+        __m128i e1 = _mm_add_epi64(_mm_set1_epi64x(row[1]), edge_lane[1]);
+        __m128i e2 = _mm_add_epi64(_mm_set1_epi64x(row[2]), edge_lane[2]);
+        double z_step = tri.depth_at(row);
+        for (int i = 0; i < 3; i++) row[i] += tri.edge_dy[i];
+        bool entered = false;
+        for (int x = x_first; x <= region.x_max; x += lanes, z_step += lanes * tri.z_dx,
+             e0 = _mm_add_epi64(e0, edge_span[0]), e1 = _mm_add_epi64(e1, edge_span[1]), e2 = _mm_add_epi64(e2, edge_span[2])) {
+            const BlockState state = row_state[x / hiz_block_size - region.bx_min];
+            if (state == Occluded) continue;
+
+            const int in_region = (0x3 << std::max(0, region.x_min - x)) & (0x3 >> std::max(0, x + lanes - 1 - region.x_max));
+            // a lane is covered when no edge is negative, i.e. none of the three has its sign bit set
+            const int covered = ~_mm_movemask_pd(_mm_castsi128_pd(_mm_or_si128(_mm_or_si128(e0, e1), e2))) & in_region;
+            if (!covered) {
+                if (entered) break;
+                continue;
+            }
+            entered = true;
+            MR_INSTRUMENT_ONLY(tile_counters[region.tile].pixels_tested += __builtin_popcount(covered);)
+
+            alignas(16) depth_t depth[4];
+            const __m128d z = _mm_add_pd(_mm_set1_pd(z_step), z_lane);
+            const int readable = std::min(lanes, region.x_max - x + 1);
+            const int nearer = rasterizer_detail::depth_test_sse2(z, &z_buffer[get_index(x, y)], readable, depth);
+            for (int passed = state == Visible ? covered : covered & nearer; passed; passed &= passed - 1) {
+                const int i = __builtin_ctz(passed);
+                if (shade_pixel(shader, tri, x + i, y, depth[i])) {
+                    MR_INSTRUMENT_ONLY(count_pass(region.tile, x + i, y);)
+                }
+            }
+        }
+    }
+}
+
+template<typename Shader>
+__attribute__((target("avx2")))
+void Rasterizer::fill_avx2(const Shader& shader, const Triangle& tri, const FillRegion& region) {
+    constexpr int lanes = 4;
+    const int x_first = region.x_min & ~(lanes - 1);
+    std::int64_t row[3];
+    tri.edges_at(x_first, region.y_min, row);
+
+    // lane i is i pixels to the right of the span start, the edge products fit 64 bit lanes
+    __m256i edge_lane[3], edge_span[3];
+    for (int i = 0; i < 3; i++) {
+        edge_lane[i] = _mm256_set_epi64x(3 * tri.edge_dx[i], 2 * tri.edge_dx[i], tri.edge_dx[i], 0);
+        edge_span[i] = _mm256_set1_epi64x(lanes * tri.edge_dx[i]);
+    }
+    const __m256d z_lane = _mm256_mul_pd(_mm256_set_pd(3, 2, 1, 0), _mm256_set1_pd(tri.z_dx));
+
+    for (int y = region.y_min; y <= region.y_max; y++) {
+        const BlockState* row_state = region.block_state[y / hiz_block_size - region.by_min];
+        __m256i e0 = _mm256_add_epi64(_mm256_set1_epi64x(row[0]), edge_lane[0]);
+        __m256i e1 = _mm256_add_epi64(_mm256_set1_epi64x(row[1]), edge_lane[1]);
+        __m256i e2 = _mm256_add_epi64(_mm256_set1_epi64x(row[2]), edge_lane[2]);
+        double z_step = tri.depth_at(row);
+        for (int i = 0; i < 3; i++) row[i] += tri.edge_dy[i];
+        bool entered = false;
+        for (int x = x_first; x <= region.x_max; x += lanes, z_step += lanes * tri.z_dx,
+             e0 = _mm256_add_epi64(e0, edge_span[0]), e1 = _mm256_add_epi64(e1, edge_span[1]), e2 = _mm256_add_epi64(e2, edge_span[2])) {
+            const BlockState state = row_state[x / hiz_block_size - region.bx_min];
+            if (state == Occluded) continue;
+
+            const int in_region = (0xF << std::max(0, region.x_min - x)) & (0xF >> std::max(0, x + lanes - 1 - region.x_max));
+            // a lane is covered when no edge is negative, i.e. none of the three has its sign bit set
+            const int covered = ~_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_or_si256(_mm256_or_si256(e0, e1), e2))) & in_region;
+            if (!covered) {
+                if (entered) break;
+                continue;
+            }
+            entered = true;
+            MR_INSTRUMENT_ONLY(tile_counters[region.tile].pixels_tested += __builtin_popcount(covered);)
+
+            alignas(16) depth_t depth[lanes];
+            const __m256d z = _mm256_add_pd(_mm256_set1_pd(z_step), z_lane);
+            const int readable = std::min(lanes, region.x_max - x + 1);
+            const int nearer = rasterizer_detail::depth_test_avx2(z, &z_buffer[get_index(x, y)], readable, depth);
+            for (int passed = state == Visible ? covered : covered & nearer; passed; passed &= passed - 1) {
+                const int i = __builtin_ctz(passed);
+                if (shade_pixel(shader, tri, x + i, y, depth[i])) {
+                    MR_INSTRUMENT_ONLY(count_pass(region.tile, x + i, y);)
+                }
+            }
+        }
+    }
+}
+
+#else
+
+template<typename Shader>
+void Rasterizer::fill_sse2(const Shader& shader, const Triangle& tri, const FillRegion& region) { fill_scalar(shader, tri, region); }
+template<typename Shader>
+void Rasterizer::fill_avx2(const Shader& shader, const Triangle& tri, const FillRegion& region) { fill_scalar(shader, tri, region); }
+
+#endif
+
+#endif //RASTERIZER_DRAW_H
@@ -0,0 +1,59 @@
+//
+// Created by laoe on 25-10-3.
+//
+
+#ifndef BENCH_H
+#define BENCH_H
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <numeric>
+#include <string>
+#include <vector>
+
+// statistics of repeated timings, in seconds
+struct Summary {
+    double min, median, mean, stddev;
+};
+
+inline Summary summarize(std::vector<double> samples) {
+    std::sort(samples.begin(), samples.end());
+    const size_t n = samples.size();
+    const double mean = std::accumulate(samples.begin(), samples.end(), 0.) / n;
+    double variance = 0;
+    for (double s : samples) variance += (s - mean) * (s - mean);
+    return {samples[0], n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2, mean,
+            n > 1 ? std::sqrt(variance / (n - 1)) : 0};
+}
+
+// warmup untimed calls of f, then runs timed ones
+template<typename F> Summary measure(F&& f, int runs = 5, int warmup = 1) {
+    for (int r = 0; r < warmup; r++) f();
+    std::vector<double> samples;
+    for (int r = 0; r < runs; r++) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        samples.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return summarize(samples);
+}
+
+// throughput from the median
+inline void report(const char* name, const Summary& s, double ops) {
+    std::printf("%-48s %10.3f ms min %10.3f ms median %6.1f%% sd %10.2f Mop/s\n", name, s.min * 1e3, s.median * 1e3,
+                s.stddev / s.mean * 100, ops / s.median * 1e-6);
+}
+
+// benchmark [filter...]: only what has one of the filters in its name runs, everything without filters
+inline std::vector<std::string> filters;
+inline bool selected(const std::string& name) {
+    return filters.empty() || std::any_of(filters.begin(), filters.end(), [&](const std::string& f) {
+        return name.find(f) != std::string::npos;
+    });
+}
+
+// whole frames of the bundled models, scenarios.cpp
+void bench_scenarios();
+
+#endif //BENCH_H
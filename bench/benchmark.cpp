@@ -0,0 +1,209 @@
+//
+// Created by laoe on 25-9-21.
+//
+
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../geometry.h"
+#include "../geometryf.h"
+#include "../model.h"
+#include "../optimize.h"
+#include "../texture.h"
+#include "../tgaimage.h"
+#include "../util.h"
+#include "bench.h"
+
+namespace {
+
+volatile double sink;
+
+mat4 random_matrix(std::mt19937& rng) {
+    std::uniform_real_distribution<double> dist(-1, 1);
+    mat4 m;
+    for (int i=0; i<4; i++) for (int j=0; j<4; j++) m[i][j] = dist(rng);
+    return m;
+}
+
+void bench_transforms() {
+    constexpr int n = 1 << 20;
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> dist(-1, 1);
+    const mat4 m = random_matrix(rng);
+    const mat4f mf = to_mat4f(m);
+
+    std::vector<vec4> points(n), out(n);
+    std::vector<vec4f> pointsf(n), outf(n);
+    for (int i = 0; i < n; i++) {
+        points[i] = {dist(rng), dist(rng), dist(rng), 1};
+        pointsf[i] = to_vec4f({points[i].x, points[i].y, points[i].z});
+    }
+
+    report("mat4 * vec4 (double templates)", measure([&] {
+        for (int i = 0; i < n; i++) out[i] = m * points[i];
+        sink = out[n - 1].x;
+    }), n);
+    report("mat4f * vec4f", measure([&] {
+        for (int i = 0; i < n; i++) outf[i] = mf * pointsf[i];
+        sink = outf[n - 1].x;
+    }), n);
+    report("transform_points", measure([&] {
+        transform_points(mf, pointsf.data(), outf.data(), n);
+        sink = outf[n - 1].x;
+    }), n);
+
+    constexpr int nm = 1 << 16;
+    std::vector<mat4> mats(nm), outm(nm);
+    std::vector<mat4f> matsf(nm), outmf(nm);
+    for (int i = 0; i < nm; i++) {
+        mats[i] = random_matrix(rng);
+        matsf[i] = to_mat4f(mats[i]);
+    }
+    report("mat4 * mat4 (double templates)", measure([&] {
+        for (int i = 0; i < nm; i++) outm[i] = mats[i] * m;
+        sink = outm[nm - 1][0][0];
+    }), nm);
+    report("mat4f * mat4f", measure([&] {
+        for (int i = 0; i < nm; i++) outmf[i] = matsf[i] * mf;
+        sink = outmf[nm - 1].col[0].x;
+    }), nm);
+    report("mat4::invert", measure([&] {
+        for (int i = 0; i < nm; i++) outm[i] = mats[i].invert();
+        sink = outm[nm - 1][0][0];
+    }), nm);
+    report("mat4::transpose", measure([&] {
+        for (int i = 0; i < nm; i++) outm[i] = mats[i].transpose();
+        sink = outm[nm - 1][0][0];
+    }), nm);
+}
+
+// the vec3 operators of the shaders and the setup: dot, cross, normalize
+void bench_vectors() {
+    constexpr int n = 1 << 20;
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> dist(-1, 1);
+    std::vector<vec3> a(n), b(n), out(n);
+    for (int i = 0; i < n; i++) {
+        a[i] = {dist(rng), dist(rng), dist(rng)};
+        b[i] = {dist(rng), dist(rng), dist(rng)};
+    }
+    report("vec3 * vec3 (dot)", measure([&] {
+        double acc = 0;
+        for (int i = 0; i < n; i++) acc += a[i] * b[i];
+        sink = acc;
+    }), n);
+    report("vec3 ^ vec3 (cross)", measure([&] {
+        for (int i = 0; i < n; i++) out[i] = a[i] ^ b[i];
+        sink = out[n - 1].x;
+    }), n);
+    report("normalize(vec3)", measure([&] {
+        for (int i = 0; i < n; i++) out[i] = normalize(a[i]);
+        sink = out[n - 1].x;
+    }), n);
+}
+
+// the reference barycentric test the fill kernels replaced, over a grid covering one triangle's bounding box
+void bench_barycentric() {
+    constexpr int n = 1024;
+    const vec3 v3s[3] = {{10, 20, 0}, {1000, 80, 0}, {400, 1010, 0}};
+    report("compute_barycentric_2D", measure([&] {
+        double acc = 0;
+        for (int y = 0; y < n; y++) for (int x = 0; x < n; x++) {
+            auto [alpha, beta, gamma] = compute_barycentric_2D(x + .5, y + .5, v3s);
+            acc += alpha + beta * gamma;
+        }
+        sink = acc;
+    }), n * n);
+}
+
+// RLE encode and decode of a texture and of a rendered-like image of flat runs, through a temporary file
+void bench_tga(const char* filename) {
+    TGAImage texture;
+    if (!texture.read_tga_file(filename)) return;
+    TGAImage flat(1600, 900, TGAImage::RGB);
+    for (int y = 0; y < flat.height(); y++) for (int x = 0; x < flat.width(); x++) {
+        const bool inside = (x - 800) * (x - 800) + (y - 450) * (y - 450) < 400 * 400;
+        flat.set(x, y, inside ? TGAColor{static_cast<std::uint8_t>(x / 64 * 10), 128, 200, 255} : TGAColor{});
+    }
+    const std::string path = (std::filesystem::temp_directory_path() / "benchmark_rle.tga").string();
+    const std::pair<const char*, const TGAImage*> images[] = {{"texture", &texture}, {"flat", &flat}};
+    for (auto [name, image] : images) {
+        const double pixels = static_cast<double>(image->width()) * image->height();
+        report((std::string("TGAImage write raw, ") + name).c_str(), measure([&] { image->write_tga_file(path, true, false); }), pixels);
+        report((std::string("TGAImage write rle, ") + name).c_str(), measure([&] { image->write_tga_file(path, true, true); }), pixels);
+        TGAImage read;
+        report((std::string("TGAImage read rle, ") + name).c_str(), measure([&] { read.read_tga_file(path); }), pixels);
+    }
+    std::filesystem::remove(path);
+}
+
+// walks a rotated, minified grid of uv like a textured triangle seen at an angle would
+void bench_texture(const char* filename) {
+    TGAImage image;
+    if (!image.read_tga_file(filename)) return;
+    const Texture texture(image);
+    constexpr int n = 512;
+    const double scale = 3.0 / n, c = std::cos(0.3), s = std::sin(0.3);
+    const vec2 duv_dx {c * scale, s * scale}, duv_dy {-s * scale, c * scale};
+    auto uv_at = [&](int x, int y) { return vec2 {0.1 + x * duv_dx.x + y * duv_dy.x, 0.1 + x * duv_dx.y + y * duv_dy.y}; };
+
+    report("TGAImage::get", measure([&] {
+        double acc = 0;
+        for (int y = 0; y < n; y++) for (int x = 0; x < n; x++) {
+            const vec2 uv = uv_at(x, y);
+            const double u = uv.x - std::floor(uv.x), v = uv.y - std::floor(uv.y);
+            acc += image.get(static_cast<int>(u * image.width()), static_cast<int>((1 - v) * image.height()))[0];
+        }
+        sink = acc;
+    }), n * n);
+    const std::pair<const char*, Texture::Filter> filters[] = {
+        {"Texture nearest", Texture::Filter::Nearest},
+        {"Texture bilinear (lod)", Texture::Filter::Bilinear},
+        {"Texture trilinear (lod)", Texture::Filter::Trilinear}};
+    for (auto [name, filter] : filters) {
+        report(name, measure([&] {
+            double acc = 0;
+            for (int y = 0; y < n; y++) for (int x = 0; x < n; x++)
+                acc += texture.sample(uv_at(x, y), duv_dx, duv_dy, filter).x;
+            sink = acc;
+        }), n * n);
+    }
+}
+
+// acmr of the .obj face order and after each pass, with the time every pass takes
+void bench_vertex_cache(const char* filename) {
+    const Model model(filename, false, false);
+    if (model.faces.empty()) return;
+    const int nvertex = model.getNumberVertex();
+    std::vector<int> cached, overdraw;
+    const double cache_time = measure([&] { cached = optimize_vertex_cache(model.faces, nvertex); }, 3).median;
+    const double overdraw_time = measure([&] { overdraw = optimize_overdraw(model.vertices, cached); }, 3).median;
+    std::printf("%s: %d faces, acmr %.3f .obj order, %.3f vertex cache (%.1f ms), %.3f overdraw (%.1f ms)\n",
+                filename, model.getNumberFace(), acmr(model.faces), acmr(cached), cache_time * 1e3, acmr(overdraw),
+                overdraw_time * 1e3);
+}
+
+}
+
+// benchmark [filter...]: micro/geometry, micro/barycentric, micro/texture, micro/tga, micro/vertex_cache and
+// scene/<scene>/<width>x<height>/<shading>, run from the repository root
+int main(int argc, char** argv) {
+    filters.assign(argv + 1, argv + argc);
+    std::printf("geometryf kernel: %s\n", simd_kernel);
+    if (selected("micro/geometry")) {
+        bench_transforms();
+        bench_vectors();
+    }
+    if (selected("micro/barycentric")) bench_barycentric();
+    if (selected("micro/texture")) bench_texture("obj/african_head/african_head_diffuse.tga");
+    if (selected("micro/tga")) bench_tga("obj/african_head/african_head_diffuse.tga");
+    if (selected("micro/vertex_cache")) {
+        for (const char* filename : {"obj/african_head/african_head.obj", "obj/boggie/body.obj", "obj/diablo3_pose/diablo3_pose.obj"})
+            bench_vertex_cache(filename);
+    }
+    bench_scenarios();
+    return 0;
+}
@@ -0,0 +1,154 @@
+//
+// Created by laoe on 25-10-3.
+//
+
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "../camera.h"
+#include "../mesh.h"
+#include "../model.h"
+#include "../Rasterizer.h"
+#include "../shader.h"
+#include "../texture.h"
+#include "../tgaimage.h"
+#include "bench.h"
+
+namespace {
+
+struct SceneSpec {
+    const char* name;
+    std::vector<const char*> models;
+};
+
+const SceneSpec scenes[] = {
+    {"african_head", {"obj/african_head/african_head.obj", "obj/african_head/african_head_eye_inner.obj",
+                      "obj/african_head/african_head_eye_outer.obj"}},
+    {"boggie", {"obj/boggie/body.obj", "obj/boggie/head.obj", "obj/boggie/eyes.obj"}},
+    {"diablo3_pose+floor", {"obj/diablo3_pose/diablo3_pose.obj", "obj/floor.obj"}},
+};
+
+struct Resolution {
+    int width, height;
+};
+constexpr Resolution resolutions[] = {{640, 360}, {1600, 900}, {3840, 2160}};
+
+enum class Shading { Flat, Phong, PhongDeferred, PhongMSAA4 };
+constexpr std::pair<Shading, const char*> shadings[] = {
+    {Shading::Flat, "flat"}, {Shading::Phong, "phong"}, {Shading::PhongDeferred, "phong-deferred"},
+    {Shading::PhongMSAA4, "phong-msaa4x"}};
+
+constexpr int warmup = 1, runs = 5;
+
+// the camera of main
+constexpr vec3 eye {0, 0, 1}, center {0, 0, 2}, up {0, 1, 0}, light {1, 1, 1};
+
+struct Object {
+    Model model;
+    Mesh mesh;
+    Texture diffuse, specular;
+    explicit Object(const char* filename)
+        : model(filename), mesh(model), diffuse(load_model_texture(filename, "_diffuse")),
+          specular(load_model_texture(filename, "_spec")) {}
+};
+
+std::string scenario_name(const SceneSpec& scene, const Resolution& resolution, const char* shading) {
+    return std::string("scene/") + scene.name + "/" + std::to_string(resolution.width) + "x" +
+           std::to_string(resolution.height) + "/" + shading;
+}
+
+// parsing alone, parsing with the optimisation and level of detail passes, and mapping the cache they produce
+void bench_load(const SceneSpec& scene) {
+    int faces = 0;
+    for (const char* filename : scene.models) faces += Model(filename).getNumberFace();
+    const std::string prefix = std::string("scene/") + scene.name + "/";
+    report((prefix + "load obj").c_str(), measure([&] {
+        for (const char* filename : scene.models) Model(filename, false, false);
+    }, 3), faces);
+    report((prefix + "load obj + optimize").c_str(), measure([&] {
+        for (const char* filename : scene.models) Model(filename, false, true);
+    }, 3), faces);
+    report((prefix + "load cache").c_str(), measure([&] {
+        for (const char* filename : scene.models) Model(filename, true, true);
+    }), faces);
+}
+
+void bench_frames(const SceneSpec& scene, const std::vector<std::unique_ptr<Object>>& objects, const Resolution& resolution,
+                  Shading shading, const char* shading_name) {
+    Rasterizer rasterizer(resolution.width, resolution.height);
+    rasterizer.set_view_matrix(view_matrix(eye, center, up));
+    rasterizer.set_projection_matrix(perspective_projection(150, static_cast<double>(resolution.width) / resolution.height, 2, 3));
+    rasterizer.set_cull_mode(Rasterizer::CullMode::Back);
+    if (shading == Shading::PhongMSAA4) rasterizer.set_samples(4);
+
+    std::vector<std::variant<FaceNormalShader, PhongShader>> shaders;
+    int faces = 0;
+    for (const auto& object : objects) {
+        faces += object->mesh.face_count();
+        if (shading == Shading::Flat) {
+            shaders.emplace_back(std::in_place_type<FaceNormalShader>, object->mesh.get_vertices(), object->mesh.get_indices());
+            continue;
+        }
+        Lighting lighting(light, eye);
+        lighting.diffuse = object->diffuse.empty() ? nullptr : &object->diffuse;
+        lighting.specular = object->specular.empty() ? nullptr : &object->specular;
+        shaders.emplace_back(std::in_place_type<PhongShader>, object->model, lighting);
+    }
+
+    TGAImage framebuffer(resolution.width, resolution.height, TGAImage::RGB);
+    auto frame = [&] {
+        rasterizer.clear_targets();
+        for (size_t i = 0; i < objects.size(); i++) {
+            std::visit([&](const auto& shader) {
+                if (shading == Shading::PhongDeferred) rasterizer.draw_deferred(objects[i]->mesh, identity_matrix<4>(), shader);
+                else rasterizer.draw(objects[i]->mesh, identity_matrix<4>(), shader);
+            }, shaders[i]);
+        }
+        rasterizer.drawonTGA(framebuffer);
+    };
+    for (int r = 0; r < warmup; r++) frame();
+    rasterizer.reset_stage_times();
+    const Summary s = measure(frame, runs, 0);
+    const Rasterizer::StageTimes& stages = rasterizer.get_stage_times();
+
+    const std::string filename = (std::filesystem::temp_directory_path() / "benchmark_frame.tga").string();
+    const Summary encode = measure([&] { framebuffer.write_tga_file(filename); }, 3);
+    std::filesystem::remove(filename);
+
+    const double pixels = static_cast<double>(resolution.width) * resolution.height;
+    std::printf("%-48s %8.2f ms min %8.2f ms median %5.1f%% sd | vertex %7.2f setup %7.2f fill %7.2f resolve %7.2f"
+                " tga %7.2f ms | %7.2f Mtri/s %8.1f Mpix/s\n",
+                scenario_name(scene, resolution, shading_name).c_str(), s.min * 1e3, s.median * 1e3,
+                s.stddev / s.mean * 100, stages.vertex / runs * 1e3, stages.setup / runs * 1e3, stages.fill / runs * 1e3,
+                stages.resolve / runs * 1e3, encode.median * 1e3, faces / s.median * 1e-6, pixels / s.median * 1e-6);
+}
+
+}
+
+// every scene at every resolution and shading, from the repository root; per-stage times are means over the timed
+// frames, tga is the RLE encode and write of one frame
+void bench_scenarios() {
+    for (const SceneSpec& scene : scenes) {
+        bool any = false;
+        for (const Resolution& resolution : resolutions)
+            for (auto [shading, name] : shadings) any |= selected(scenario_name(scene, resolution, name));
+        if (!any && !selected(std::string("scene/") + scene.name + "/load"))
+            continue;
+        if (!std::filesystem::exists(scene.models[0])) {
+            std::printf("scene/%s: %s not found, run from the repository root\n", scene.name, scene.models[0]);
+            continue;
+        }
+        if (selected(std::string("scene/") + scene.name + "/load")) bench_load(scene);
+        std::vector<std::unique_ptr<Object>> objects;
+        for (const char* filename : scene.models) objects.push_back(std::make_unique<Object>(filename));
+        for (const Resolution& resolution : resolutions) {
+            for (auto [shading, name] : shadings) {
+                if (selected(scenario_name(scene, resolution, name))) bench_frames(scene, objects, resolution, shading, name);
+            }
+        }
+    }
+}
@@ -0,0 +1,20 @@
+//
+// Created by laoe on 25-9-29.
+//
+
+#include "bounds.h"
+
+std::vector<Cluster> build_clusters(std::span<const vec3> vertices, std::span<const int> indices, int cluster_faces) {
+    std::vector<Cluster> clusters;
+    const int nface = static_cast<int>(indices.size() / 3);
+    for (int first = 0; first < nface; first += cluster_faces) {
+        Cluster cluster {first, std::min(cluster_faces, nface - first), std::numeric_limits<int>::max(), -1, {}};
+        for (int i = first * 3; i < (first + cluster.face_count) * 3; i++) {
+            cluster.first_vertex = std::min(cluster.first_vertex, indices[i]);
+            cluster.last_vertex = std::max(cluster.last_vertex, indices[i]);
+            cluster.box.extend(vertices[indices[i]]);
+        }
+        clusters.push_back(cluster);
+    }
+    return clusters;
+}
@@ -0,0 +1,47 @@
+//
+// Created by laoe on 25-9-29.
+//
+
+#ifndef BOUNDS_H
+#define BOUNDS_H
+#include <algorithm>
+#include <limits>
+#include <span>
+#include <vector>
+
+#include "geometry.h"
+
+// axis aligned bounding box, empty until a point is added
+struct AABB {
+    vec3 min {std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), std::numeric_limits<double>::max()};
+    vec3 max {-std::numeric_limits<double>::max(), -std::numeric_limits<double>::max(), -std::numeric_limits<double>::max()};
+
+    [[nodiscard]] bool empty() const { return min.x > max.x; }
+    [[nodiscard]] vec3 center() const { return (min + max) / 2.; }
+    [[nodiscard]] vec3 corner(int i) const { return {i & 1 ? max.x : min.x, i & 2 ? max.y : min.y, i & 4 ? max.z : min.z}; }
+    void extend(const vec3& p) {
+        for (int k = 0; k < 3; k++) min[k] = std::min(min[k], p[k]), max[k] = std::max(max[k], p[k]);
+    }
+    void extend(const AABB& box) {
+        if (!box.empty()) extend(box.min), extend(box.max);
+    }
+    // box around the transformed corners, for affine m
+    [[nodiscard]] AABB transformed(const mat4& m) const {
+        AABB box;
+        if (!empty()) for (int i = 0; i < 8; i++) box.extend((m * corner(i).to_vec4(1.)).to_vec3());
+        return box;
+    }
+};
+
+// run of consecutive faces of a mesh with the bounds of their vertices, the unit of culling inside a mesh
+struct Cluster {
+    int first_face, face_count;
+    int first_vertex, last_vertex; // range of the vertex indices the faces use
+    AABB box;
+};
+
+// splits the faces into clusters of cluster_faces consecutive faces, meshes loaded from .obj files keep
+// neighbouring faces together so the clusters are compact
+std::vector<Cluster> build_clusters(std::span<const vec3> vertices, std::span<const int> indices, int cluster_faces = 128);
+
+#endif //BOUNDS_H
@@ -0,0 +1,54 @@
+//
+// Created by laoe on 25-10-3.
+//
+
+#include <cmath>
+
+#include "camera.h"
+
+mat4 view_matrix(const vec3 &eye, const vec3 &center, const vec3 &up) {
+    vec3 z = normalize(eye - center);
+    vec3 x = normalize(up ^ z);
+    vec3 y = normalize(z ^ x);
+    mat4 rotate {{{x.x, x.y, x.z, 0},
+                        {y.x, y.y, y.z, 0},
+                        {z.x, z.y, z.z, 0},
+                        {0,   0,   0,   1}}};
+    mat4 translate {{{1, 0, 0, -center.x},
+                        {0, 1, 0, -center.y},
+                        {0, 0, 1, -center.z},
+                        {0, 0, 0, 1}}};
+    return rotate * translate;
+}
+
+mat4 orthographic_projection(const double near, const double far, const double right, const double left, const double top, const double bottom) {
+    mat4 translate {{{1, 0, 0, -(left + right) / 2},
+                        {0, 1, 0, -(top + bottom) / 2},
+                        {0, 0, 1, -(near + far) / 2},
+                        {0, 0, 0, 1}}};
+    mat4 scale {{{2 / (right - left), 0, 0, 0},
+                        {0, 2 / (top - bottom), 0, 0},
+                        {0, 0, 2 / (near - far), 0},
+                        {0, 0, 0, 1}}};
+    return scale * translate;
+}
+
+mat4 perspective_projection(const double fov, const double aspect, const double near, const double far) {
+    double top = near * std::tan(fov / 2 * M_PI / 360.0);
+    double bottom = -top;
+    double right = top * aspect;
+    double left = -right;
+    mat4 orth = orthographic_projection(near, far, right, left, top, bottom);
+    mat4 pers {{{far, 0, 0, 0},
+                        {0, far, 0, 0},
+                        {0, 0, near +far, -near*far},
+                        {0, 0, 1, 0}}};
+    return orth * pers;
+}
+
+mat4 viewport_matrix(int w, int h) {
+    return {{{w/2., 0, 0, w/2.},
+                        {0, h/2., 0, h/2.},
+                        {0, 0, 1, 0},
+                        {0, 0, 0, 1}}};
+}
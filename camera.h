@@ -0,0 +1,16 @@
+//
+// Created by laoe on 25-10-3.
+//
+
+#ifndef CAMERA_H
+#define CAMERA_H
+#include "geometry.h"
+
+// matrices for Rasterizer::set_view_matrix and set_projection_matrix
+
+mat4 view_matrix(const vec3 &eye, const vec3 &center, const vec3 &up);
+mat4 orthographic_projection(double near, double far, double right, double left, double top, double bottom);
+mat4 perspective_projection(double fov, double aspect, double near, double far);
+mat4 viewport_matrix(int w, int h);
+
+#endif //CAMERA_H
@@ -0,0 +1,104 @@
+//
+// Created by laoe on 25-9-21.
+//
+
+#ifndef GEOMETRYF_H
+#define GEOMETRYF_H
+
+#include <cstddef>
+
+#include "geometry.h"
+
+// single precision vec4/mat4 for the hot paths, vectorised with the widest kernel enabled at compile time:
+// AVX2+FMA, then SSE2, then plain scalar code. Define MR_SIMD_SCALAR to force the fallback.
+#if !defined(MR_SIMD_SCALAR) && defined(__AVX2__) && defined(__FMA__)
+#define MR_SIMD_AVX2
+#endif
+#if !defined(MR_SIMD_SCALAR) && (defined(__SSE2__) || defined(_M_X64))
+#define MR_SIMD_SSE
+#endif
+
+#if defined(MR_SIMD_AVX2) || defined(MR_SIMD_SSE)
+#include <immintrin.h>
+#endif
+
+#if defined(MR_SIMD_AVX2)
+constexpr const char* simd_kernel = "avx2";
+#elif defined(MR_SIMD_SSE)
+constexpr const char* simd_kernel = "sse";
+#else
+constexpr const char* simd_kernel = "scalar";
+#endif
+
+struct alignas(16) vec4f {
+    float x = 0, y = 0, z = 0, w = 0;
+};
+
+//store vertical vectors, so m * v is a sum of columns scaled by the components of v
+struct alignas(16) mat4f {
+    vec4f col[4];
+};
+
+inline vec4f to_vec4f(const vec3& v, float w = 1.f) {
+    return {static_cast<float>(v.x), static_cast<float>(v.y), static_cast<float>(v.z), w};
+}
+
+inline vec4 to_vec4(const vec4f& v) {
+    return {v.x, v.y, v.z, v.w};
+}
+
+inline mat4f to_mat4f(const mat4& m) {
+    mat4f res;
+    for (int j=0; j<4; j++) {
+        res.col[j] = {static_cast<float>(m[0][j]), static_cast<float>(m[1][j]),
+                      static_cast<float>(m[2][j]), static_cast<float>(m[3][j])};
+    }
+    return res;
+}
+
+inline vec4f operator*(const mat4f& m, const vec4f& v) {
+#ifdef MR_SIMD_SSE
+    __m128 r = _mm_mul_ps(_mm_load_ps(&m.col[0].x), _mm_set1_ps(v.x));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_load_ps(&m.col[1].x), _mm_set1_ps(v.y)));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_load_ps(&m.col[2].x), _mm_set1_ps(v.z)));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_load_ps(&m.col[3].x), _mm_set1_ps(v.w)));
+    vec4f res;
+    _mm_store_ps(&res.x, r);
+    return res;
+#else
+    const vec4f* c = m.col;
+    return {c[0].x*v.x + c[1].x*v.y + c[2].x*v.z + c[3].x*v.w,
+            c[0].y*v.x + c[1].y*v.y + c[2].y*v.z + c[3].y*v.w,
+            c[0].z*v.x + c[1].z*v.y + c[2].z*v.z + c[3].z*v.w,
+            c[0].w*v.x + c[1].w*v.y + c[2].w*v.z + c[3].w*v.w};
+#endif
+}
+
+inline mat4f operator*(const mat4f& m1, const mat4f& m2) {
+    mat4f res;
+    for (int j=0; j<4; j++) res.col[j] = m1 * m2.col[j];
+    return res;
+}
+
+// out[i] = m * in[i] for n points, in and out must not overlap
+inline void transform_points(const mat4f& m, const vec4f* in, vec4f* out, size_t n) {
+    size_t i = 0;
+#ifdef MR_SIMD_AVX2
+    // two points per iteration, one in each 128-bit lane
+    const __m256 c0 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(&m.col[0]));
+    const __m256 c1 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(&m.col[1]));
+    const __m256 c2 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(&m.col[2]));
+    const __m256 c3 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(&m.col[3]));
+    for (; i + 2 <= n; i += 2) {
+        const __m256 v = _mm256_loadu_ps(&in[i].x);
+        __m256 r = _mm256_mul_ps(c0, _mm256_permute_ps(v, 0x00));
+        r = _mm256_fmadd_ps(c1, _mm256_permute_ps(v, 0x55), r);
+        r = _mm256_fmadd_ps(c2, _mm256_permute_ps(v, 0xAA), r);
+        r = _mm256_fmadd_ps(c3, _mm256_permute_ps(v, 0xFF), r);
+        _mm256_storeu_ps(&out[i].x, r);
+    }
+#endif
+    for (; i < n; i++) out[i] = m * in[i];
+}
+
+#endif //GEOMETRYF_H
@@ -0,0 +1,81 @@
+//
+// Created by laoe on 25-10-4.
+//
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "instrument.h"
+
+namespace {
+
+struct TraceEvent {
+    const char* name;
+    std::chrono::steady_clock::time_point begin, end;
+};
+
+struct ThreadTrace {
+    int id;
+    std::vector<TraceEvent> events;
+};
+
+// buffers outlive their threads, so spans of finished threads are still written
+std::mutex registry_mutex;
+std::vector<std::unique_ptr<ThreadTrace>> registry;
+const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+ThreadTrace& thread_trace() {
+    thread_local ThreadTrace* trace = nullptr;
+    if (!trace) {
+        std::lock_guard lock(registry_mutex);
+        registry.push_back(std::make_unique<ThreadTrace>(ThreadTrace{static_cast<int>(registry.size()), {}}));
+        trace = registry.back().get();
+    }
+    return *trace;
+}
+
+double microseconds(std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration<double, std::micro>(t - epoch).count();
+}
+
+}
+
+namespace instrument {
+
+void record(const char* name, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end) {
+    thread_trace().events.push_back({name, begin, end});
+}
+
+bool write_trace(const std::string& filename) {
+    std::ofstream out(filename);
+    if (!out.is_open()) {
+        std::cerr << "can't write trace " << filename << "\n";
+        return false;
+    }
+    std::lock_guard lock(registry_mutex);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    for (const auto& thread : registry) {
+        out << (first ? "" : ",\n") << R"({"name": "thread_name", "ph": "M", "pid": 1, "tid": )" << thread->id
+            << R"(, "args": {"name": ")" << (thread->id == 0 ? "main" : "worker " + std::to_string(thread->id)) << "\"}}";
+        first = false;
+        for (const TraceEvent& event : thread->events) {
+            // names are string literals of the pipeline, they need no escaping
+            out << ",\n" << R"({"name": ")" << event.name << R"(", "ph": "X", "pid": 1, "tid": )" << thread->id
+                << ", \"ts\": " << microseconds(event.begin) << ", \"dur\": " << microseconds(event.end) - microseconds(event.begin)
+                << "}";
+        }
+    }
+    out << "\n]}\n";
+    return out.good();
+}
+
+void clear_trace() {
+    std::lock_guard lock(registry_mutex);
+    for (const auto& thread : registry) thread->events.clear();
+}
+
+}
@@ -0,0 +1,68 @@
+//
+// Created by laoe on 25-10-4.
+//
+
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Pipeline instrumentation, compiled in with MR_INSTRUMENT (cmake -Dinstrumentation=ON). Without it the macros
+// below expand to nothing, the counters stay zero and the trace stays empty, at no cost to the pipeline.
+#ifdef MR_INSTRUMENT
+#define MR_INSTRUMENT_ONLY(...) __VA_ARGS__
+#define MR_TRACE_CONCAT_(a, b) a##b
+#define MR_TRACE_CONCAT(a, b) MR_TRACE_CONCAT_(a, b)
+#define MR_TRACE_SCOPE(name) const instrument::TraceScope MR_TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#else
+#define MR_INSTRUMENT_ONLY(...)
+#define MR_TRACE_SCOPE(name)
+#endif
+
+// what a Rasterizer did since construction or its last reset_counters()
+struct PipelineCounters {
+    std::uint64_t triangles_submitted = 0;  // faces of the drawn level of detail, once per instance
+    std::uint64_t triangles_culled = 0;     // by instance or cluster culling, trivial reject, facing or setup
+    std::uint64_t triangles_clipped = 0;    // crossing the near plane, before clipping
+    std::uint64_t triangles_rasterized = 0; // set up and binned, after clipping
+    std::uint64_t pixels_tested = 0;        // covered pixels outside the blocks hi-z rejected
+    std::uint64_t pixels_passed = 0;        // of those, the ones that passed the depth test and were not discarded
+    std::uint64_t pixels_overdrawn = 0;     // of those, the ones that already had a color in this frame
+
+    PipelineCounters& operator+=(const PipelineCounters& c) {
+        triangles_submitted += c.triangles_submitted;
+        triangles_culled += c.triangles_culled;
+        triangles_clipped += c.triangles_clipped;
+        triangles_rasterized += c.triangles_rasterized;
+        pixels_tested += c.pixels_tested;
+        pixels_passed += c.pixels_passed;
+        pixels_overdrawn += c.pixels_overdrawn;
+        return *this;
+    }
+};
+
+// Timeline of named spans per thread, for chrome://tracing or ui.perfetto.dev. Every thread records into its
+// own buffer, so recording takes no lock after a thread's first span.
+namespace instrument {
+
+void record(const char* name, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end);
+
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) : name(name), begin(std::chrono::steady_clock::now()) {}
+    ~TraceScope() { record(name, begin, std::chrono::steady_clock::now()); }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+private:
+    const char* name;
+    std::chrono::steady_clock::time_point begin;
+};
+
+// writes every span recorded so far as Chrome trace-event JSON; no thread may be recording meanwhile
+bool write_trace(const std::string& filename);
+void clear_trace();
+
+}
+
+#endif //INSTRUMENT_H
@@ -1,15 +1,31 @@
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <cmath>
+#include <cstdio>
 #include <iostream>
+#include <memory>
 #include <cstdlib>
 #include <ctime>
 #include <sstream>
+#include <string>
+#include <type_traits>
+#include <variant>
+#include <vector>
 
 #include "tgaimage.h"
 #include "model.h"
+#include "camera.h"
 #include "geometry.h"
+#include "instrument.h"
+#include "mesh.h"
 #include "Rasterizer.h"
+#include "scene.h"
+#include "sequence.h"
+#include "server.h"
+#include "shader.h"
+#include "shadow.h"
+#include "texture.h"
 
 constexpr TGAColor white   = {255, 255, 255, 255}; // attention, BGRA order
 constexpr TGAColor green   = {  0, 255,   0, 255};
@@ -21,53 +37,6 @@ mat4 model_matrix() {
     return identity_matrix<4>();
 }
 
-mat4 view_matrix(const vec3 &eye, const vec3 &center, const vec3 &up) {
-    vec3 z = normalize(eye - center);
-    vec3 x = normalize(up ^ z);
-    vec3 y = normalize(z ^ x);
-    mat4 rotate {{{x.x, x.y, x.z, 0},
-                        {y.x, y.y, y.z, 0},
-                        {z.x, z.y, z.z, 0},
-                        {0,   0,   0,   1}}};
-    mat4 translate {{{1, 0, 0, -center.x},
-                        {0, 1, 0, -center.y},
-                        {0, 0, 1, -center.z},
-                        {0, 0, 0, 1}}};
-    return rotate * translate;
-}
-
-mat4 orthographic_projection(const double near, const double far, const double right, const double left, const double top, const double bottom) {
-    mat4 translate {{{1, 0, 0, -(left + right) / 2},
-                        {0, 1, 0, -(top + bottom) / 2},
-                        {0, 0, 1, -(near + far) / 2},
-                        {0, 0, 0, 1}}};
-    mat4 scale {{{2 / (right - left), 0, 0, 0},
-                        {0, 2 / (top - bottom), 0, 0},
-                        {0, 0, 2 / (near - far), 0},
-                        {0, 0, 0, 1}}};
-    return scale * translate;
-}
-
-mat4 perspective_projection(const double fov, const double aspect, const double near, const double far) {
-    double top = near * std::tan(fov / 2 * M_PI / 360.0);
-    double bottom = -top;
-    double right = top * aspect;
-    double left = -right;
-    mat4 orth = orthographic_projection(near, far, right, left, top, bottom);
-    mat4 pers {{{far, 0, 0, 0},
-                        {0, far, 0, 0},
-                        {0, 0, near +far, -near*far},
-                        {0, 0, 1, 0}}};
-    return orth * pers;
-}
-
-mat4 viewport_matrix(int w, int h) {
-    return {{{w/2., 0, 0, w/2.},
-                        {0, h/2., 0, h/2.},
-                        {0, 0, 1, 0},
-                        {0, 0, 0, 1}}};
-}
-
 int main(int argc, char** argv) {
     constexpr double fov = 150.0;
     constexpr double aspect = 16.0 / 9.0;
@@ -80,24 +49,197 @@ int main(int argc, char** argv) {
     constexpr vec3 eye    = {0, 0, 1};
     constexpr vec3 center = {0, 0, 2};
     constexpr vec3 up     = {0, 1, 0};
+    constexpr vec3 light  = {1, 1, 1};  // direction towards the light
+
+    // tinyrenderer [--shader=flat|phong|normal] [--deferred] [--shadows] [--lod-error=pixels] [--msaa=2|4|8]
+    //             [--sequence=camera_path [--frames=n] [--output=prefix]]
+    //             [--stats] [--trace=trace.json] [--overdraw=overdraw.tga] [--serve[=socket]] model.obj...
+    // --lod-error draws every model at the coarsest level of detail within that many pixels, full detail without it;
+    // a sequence writes prefix0000.tga, prefix0001.tga, ... instead of framebuffer.tga, see CameraPath for the file;
+    // the last three need a build with -Dinstrumentation=ON, the heat map is of the last frame;
+    // --serve keeps the models loaded and answers render requests on stdin and stdout or a socket, see RenderServer
+    std::string shading = "flat";
+    bool deferred = false, shadows = false;
+    double lod_error = 0;
+    int msaa = 1;
+    std::string sequence, output = "frame";
+    int frames = 0;
+    bool stats = false;
+    std::string trace, overdraw;
+    bool serve = false;
+    std::string socket;
+    std::vector<std::string> filenames;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.starts_with("--shader=")) shading = arg.substr(9);
+        else if (arg == "--deferred") deferred = true;
+        else if (arg == "--shadows") shadows = true;
+        else if (arg.starts_with("--lod-error=")) lod_error = std::atof(arg.c_str() + 12);
+        else if (arg.starts_with("--msaa=")) msaa = std::atoi(arg.c_str() + 7);
+        else if (arg.starts_with("--sequence=")) sequence = arg.substr(11);
+        else if (arg.starts_with("--frames=")) frames = std::atoi(arg.c_str() + 9);
+        else if (arg.starts_with("--output=")) output = arg.substr(9);
+        else if (arg == "--stats") stats = true;
+        else if (arg.starts_with("--trace=")) trace = arg.substr(8);
+        else if (arg.starts_with("--overdraw=")) overdraw = arg.substr(11);
+        else if (arg == "--serve") serve = true;
+        else if (arg.starts_with("--serve=")) serve = true, socket = arg.substr(8);
+        else filenames.push_back(arg);
+    }
+    if (filenames.empty() || (shading != "flat" && shading != "phong" && shading != "normal") ||
+        (msaa != 1 && msaa != 2 && msaa != 4 && msaa != 8)) {
+        std::cerr << "usage: " << argv[0] << " [--shader=flat|phong|normal] [--deferred] [--shadows] [--lod-error=pixels]"
+                  << " [--msaa=2|4|8]"
+                  << " [--sequence=camera_path [--frames=n] [--output=prefix]]"
+                  << " [--stats] [--trace=trace.json] [--overdraw=overdraw.tga] [--serve[=socket]] model.obj...\n";
+        return 1;
+    }
+#ifndef MR_INSTRUMENT
+    if (stats || !trace.empty() || !overdraw.empty())
+        std::cerr << "--stats, --trace and --overdraw need a build configured with -Dinstrumentation=ON\n";
+#endif
+
+    if (serve) {
+        if (shadows) std::cerr << "--shadows is not supported by --serve\n";
+        RenderServer::Settings settings;
+        settings.shading = shading;
+        settings.deferred = deferred;
+        settings.lod_error = lod_error;
+        settings.samples = msaa;
+        settings.fov = fov, settings.near = near, settings.far = far;
+        settings.up = up, settings.light = light;
+        RenderServer server(filenames, settings);
+        if (socket.empty()) {
+            server.serve(0, 1);
+            return 0;
+        }
+        return server.listen(socket) ? 0 : 1;
+    }
 
     //projection = orthographic_projection(2, 3, aspect, -aspect, 1, -1);
 
     Rasterizer rasterizer(width, height);
 
-    rasterizer.set_model_matrix(model_matrix());
-    rasterizer.set_view_matrix(view_matrix(eye, center, up));
     rasterizer.set_projection_matrix(perspective_projection(fov, aspect, near, far));
-
-    Model model(argv[1]);
-    rasterizer.load_vertices(model.vertices);
-    rasterizer.load_indices(model.faces);
-
-    rasterizer.rasterize();
-
-    TGAImage framebuffer(width, height, TGAImage::RGB);
-    rasterizer.drawonTGA(framebuffer);
-    framebuffer.write_tga_file("framebuffer.tga");
-    return 0;
+    rasterizer.set_cull_mode(Rasterizer::CullMode::Back);
+    rasterizer.set_lod_error(lod_error);
+    rasterizer.set_samples(msaa);
+
+    // every model is uploaded once and drawn with its own model matrix and textures
+    struct SceneObject {
+        std::string filename;
+        Model model;
+        Mesh mesh;
+        mat4 transform;
+        Texture diffuse, specular, normal_map;
+        std::variant<std::monostate, FaceNormalShader, PhongShader, NormalMapShader> shader;
+        explicit SceneObject(const std::string& filename)
+            : filename(filename), model(filename), mesh(model), transform(model_matrix()) {}
+    };
+    std::vector<std::unique_ptr<SceneObject>> objects;
+    Scene scene;
+    for (const std::string& filename : filenames) {
+        auto& object = objects.emplace_back(std::make_unique<SceneObject>(filename));
+        scene.add(object->mesh, object->transform);
+        if (shading == "flat") continue;
+        object->diffuse = load_model_texture(filename, "_diffuse");
+        object->specular = load_model_texture(filename, "_spec");
+        if (shading == "normal") object->normal_map = load_model_texture(filename, "_nm_tangent");
+    }
+
+    scene.build();
+
+    std::unique_ptr<ShadowMap> shadow_map;
+    if (shadows && shading != "flat") {
+        const AABB bounds = scene.get_bounds();
+        shadow_map = std::make_unique<ShadowMap>(2048, light, bounds.min, bounds.max);
+        for (const auto& object : objects) shadow_map->render(object->mesh, object->transform);
+    }
+
+    // shaders are built once, only the eye changes between frames
+    for (const auto& object : objects) {
+        if (shading == "flat") {
+            object->shader.emplace<FaceNormalShader>(object->mesh.get_vertices(), object->mesh.get_indices());
+            continue;
+        }
+        Lighting lighting(light, eye);
+        lighting.diffuse = object->diffuse.empty() ? nullptr : &object->diffuse;
+        lighting.specular = object->specular.empty() ? nullptr : &object->specular;
+        lighting.shadow = shadow_map.get();
+        if (!object->normal_map.empty())
+            object->shader.emplace<NormalMapShader>(object->model, lighting, object->normal_map);
+        else
+            object->shader.emplace<PhongShader>(object->model, lighting);
+    }
+
+    auto render = [&](const vec3& frame_eye, const vec3& frame_center, TGAImage& framebuffer) {
+        MR_TRACE_SCOPE("frame");
+        rasterizer.set_view_matrix(view_matrix(frame_eye, frame_center, up));
+        rasterizer.clear_targets();
+        // the view puts the camera at center; objects come nearest first so they occlude the rest in the hi-z
+        scene.traverse(rasterizer, frame_center, [&](int id) {
+            const auto& object = objects[id];
+            std::visit([&](auto& shader) {
+                if constexpr (!std::is_same_v<std::decay_t<decltype(shader)>, std::monostate>) {
+                    if constexpr (requires { shader.set_eye(frame_eye); }) shader.set_eye(frame_eye);
+                    // forward or deferred, the image is the same
+                    if (deferred) rasterizer.draw_deferred(object->mesh, object->transform, shader);
+                    else rasterizer.draw(object->mesh, object->transform, shader);
+                }
+            }, object->shader);
+        });
+        rasterizer.drawonTGA(framebuffer);
+    };
+
+    // counters per frame, then the heat map and the timeline of everything rendered
+    auto report = [&]([[maybe_unused]] int nframe) {
+#ifdef MR_INSTRUMENT
+        if (stats) {
+            const PipelineCounters& c = rasterizer.get_counters();
+            std::cout << "per frame: " << c.triangles_submitted / nframe << " triangles submitted, "
+                      << c.triangles_culled / nframe << " culled, " << c.triangles_clipped / nframe << " clipped, "
+                      << c.triangles_rasterized / nframe << " rasterized; " << c.pixels_tested / nframe
+                      << " pixels tested, " << c.pixels_passed / nframe << " passed, " << c.pixels_overdrawn / nframe
+                      << " overdrawn\n";
+        }
+#endif
+        bool ok = true;
+        if (!overdraw.empty()) {
+            TGAImage heat_map(width, height, TGAImage::RGB);
+            ok &= rasterizer.draw_overdraw(heat_map) && heat_map.write_tga_file(overdraw);
+        }
+        if (!trace.empty()) ok &= instrument::write_trace(trace);
+        return ok;
+    };
+
+    if (sequence.empty()) {
+        TGAImage framebuffer(width, height, TGAImage::RGB);
+        render(eye, center, framebuffer);
+        framebuffer.write_tga_file("framebuffer.tga");
+        return report(1) ? 0 : 1;
+    }
+
+    // frame N is written on the writer's thread while frame N + 1 renders
+    CameraPath path;
+    if (!path.load(sequence))
+        return 1;
+    if (frames <= 0) frames = path.size();
+    FrameWriter writer;
+    double render_seconds = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < frames; i++) {
+        const CameraPath::Key key = path.at(i, frames);
+        TGAImage framebuffer(width, height, TGAImage::RGB);
+        const auto frame_start = std::chrono::steady_clock::now();
+        render(key.eye, key.center, framebuffer);
+        render_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - frame_start).count();
+        char filename[32];
+        std::snprintf(filename, sizeof(filename), "%04d.tga", i);
+        writer.submit(std::move(framebuffer), output + filename);
+    }
+    const bool written = writer.finish();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << frames << " frames in " << seconds << " s: " << frames / seconds << " fps, "
+              << render_seconds / frames * 1e3 << " ms rendering per frame\n";
+    return report(frames) && written ? 0 : 1;
 }
-
@@ -0,0 +1,52 @@
+//
+// Created by laoe on 25-9-20.
+//
+
+#include <fstream>
+#include "mappedfile.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MAPPEDFILE_MMAP
+#endif
+
+MappedFile::MappedFile(const std::string& filename) {
+#ifdef MAPPEDFILE_MMAP
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        struct stat st {};
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                madvise(p, st.st_size, MADV_SEQUENTIAL);
+                mapping = p;
+                begin = static_cast<const char*>(p);
+                length = st.st_size;
+                opened = true;
+            }
+        } else if (fstat(fd, &st) == 0) {
+            opened = true; // empty file, nothing to map
+        }
+        close(fd);
+        if (opened) return;
+    }
+#endif
+    std::ifstream in(filename, std::ios::binary | std::ios::ate);
+    if (!in.is_open()) return;
+    buffer.resize(in.tellg());
+    in.seekg(0);
+    in.read(buffer.data(), buffer.size());
+    if (!in.good() && !buffer.empty()) return;
+    begin = buffer.data();
+    length = buffer.size();
+    opened = true;
+}
+
+MappedFile::~MappedFile() {
+#ifdef MAPPEDFILE_MMAP
+    if (mapping) munmap(mapping, length);
+#endif
+}
@@ -0,0 +1,30 @@
+//
+// Created by laoe on 25-9-20.
+//
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// read-only view of a whole file, memory-mapped where the platform supports it
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& filename);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    [[nodiscard]] bool is_open() const { return opened; }
+    [[nodiscard]] const char* data() const { return begin; }
+    [[nodiscard]] size_t size() const { return length; }
+private:
+    bool opened = false;
+    const char* begin = nullptr;
+    size_t length = 0;
+    void* mapping = nullptr;
+    std::vector<char> buffer; // fallback storage when the file cannot be mapped
+};
+
+#endif //MAPPEDFILE_H
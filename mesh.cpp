@@ -0,0 +1,38 @@
+//
+// Created by laoe on 25-9-28.
+//
+
+#include "mesh.h"
+
+Mesh::Mesh(std::span<const vec3> vertices_, std::span<const int> indices_)
+    : vertices(vertices_.begin(), vertices_.end()), indices(indices_.begin(), indices_.begin() + indices_.size() / 3 * 3) {
+    for (const vec3& v : vertices) bounds.extend(v);
+    clusters = build_clusters(vertices, indices);
+    lods.push_back({0, static_cast<int>(indices.size() / 3), 0, static_cast<int>(clusters.size()), 0.});
+#ifdef MR_FLOAT_VERTEX_STAGE
+    float_vertices.reserve(vertices.size());
+    for (const vec3& v : vertices) float_vertices.push_back(to_vec4f(v));
+#endif
+}
+
+Mesh::Mesh(const Model& model)
+    : vertices(model.vertices.begin(), model.vertices.end()), indices(model.faces.begin(), model.faces.end()),
+      bounds(model.bounds), clusters(model.clusters) {
+    lods.push_back({0, static_cast<int>(indices.size() / 3), 0, static_cast<int>(clusters.size()), 0.});
+    for (size_t i = 1; i < model.lods.size(); i++) {
+        const std::span<const int> faces = model.lods[i].faces;
+        Lod lod {static_cast<int>(indices.size() / 3), static_cast<int>(faces.size() / 3), static_cast<int>(clusters.size()), 0,
+                 model.lods[i].error};
+        for (Cluster cluster : build_clusters(vertices, faces)) {
+            cluster.first_face += lod.first_face;
+            clusters.push_back(cluster);
+        }
+        lod.cluster_count = static_cast<int>(clusters.size()) - lod.first_cluster;
+        indices.insert(indices.end(), faces.begin(), faces.end());
+        lods.push_back(lod);
+    }
+#ifdef MR_FLOAT_VERTEX_STAGE
+    float_vertices.reserve(vertices.size());
+    for (const vec3& v : vertices) float_vertices.push_back(to_vec4f(v));
+#endif
+}
@@ -0,0 +1,53 @@
+//
+// Created by laoe on 25-9-28.
+//
+
+#ifndef MESH_H
+#define MESH_H
+#include <span>
+#include <vector>
+
+#include "bounds.h"
+#include "geometry.h"
+#include "geometryf.h"
+#include "model.h"
+
+// Geometry in the layout the vertex stage reads, uploaded once and then drawn any number of times, under any model
+// matrix, by any Rasterizer. Draws refer to it by reference, so it must outlive them.
+class Mesh {
+public:
+    // a level of detail: its faces and clusters are ranges of the mesh's, all levels share the vertices
+    struct Lod {
+        int first_face, face_count;
+        int first_cluster, cluster_count;
+        double error; // bound on the distance to the full detail surface, in model units
+    };
+
+    // indices: each 3 int is a triangle of vertices
+    Mesh(std::span<const vec3> vertices, std::span<const int> indices);
+    // reuses the bounds computed by the model and takes all its levels of detail
+    explicit Mesh(const Model& model);
+
+    [[nodiscard]] std::span<const vec3> get_vertices() const { return vertices; }
+    // the faces of every level of detail one after the other, Rasterizer::Fragment::face indexes them
+    [[nodiscard]] std::span<const int> get_indices() const { return indices; }
+    [[nodiscard]] int vertex_count() const { return static_cast<int>(vertices.size()); }
+    // at full detail
+    [[nodiscard]] int face_count() const { return lods[0].face_count; }
+    [[nodiscard]] const AABB& get_bounds() const { return bounds; }
+    [[nodiscard]] std::span<const Cluster> get_clusters() const { return clusters; }
+    // lods[0] is the full detail, the rest get coarser
+    [[nodiscard]] std::span<const Lod> get_lods() const { return lods; }
+private:
+    friend class Rasterizer;
+    std::vector<vec3> vertices;
+    std::vector<int> indices;
+    AABB bounds;
+    std::vector<Cluster> clusters; // cover the faces in order
+    std::vector<Lod> lods;
+#ifdef MR_FLOAT_VERTEX_STAGE
+    std::vector<vec4f> float_vertices; // single precision copies for transform_points
+#endif
+};
+
+#endif //MESH_H
@@ -2,31 +2,319 @@
 // Created by laoe on 25-9-4.
 //
 
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
-#include <sstream>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <unordered_map>
+#include "mappedfile.h"
 #include "model.h"
+#include "optimize.h"
 
-Model::Model(std::string filename) {
-    std::ifstream file(filename);
-
-    std::string line;
-    std::string flag;
-    while (std::getline(file, line)) {
-        std::istringstream iss(line);
-        iss >> flag;
-
-        if (flag == "v") {
-            double x, y, z;
-            iss >> x >> y >> z;
-            vertices.push_back({x, y, z});
-        } else if (flag == "f") {
-            int idx0, idx1, idx2;
-            iss >> idx0 >> flag >> idx1 >> flag >> idx2;
-            faces.push_back(--idx0);
-            faces.push_back(--idx1);
-            faces.push_back(--idx2);
+namespace {
+
+// binary mesh cache: header followed by the vertex, texcoord, normal and face arrays, then one MeshCacheLod
+// per level of detail after the first and their face arrays, native byte order
+struct MeshCacheHeader {
+    static constexpr std::uint32_t magic_value = 0x4853454D; // "MESH" read back in native order
+    static constexpr std::uint32_t version_value = 4;
+    std::uint32_t magic = magic_value;
+    std::uint32_t version = version_value;
+    std::uint32_t optimized = 0;
+    std::uint32_t reserved = 0;
+    std::uint64_t source_size = 0;
+    std::int64_t source_mtime = 0;
+    std::uint64_t nvertices = 0;
+    std::uint64_t nindices = 0;
+    std::uint64_t nlods = 0;
+};
+static_assert(sizeof(MeshCacheHeader) % alignof(double) == 0);
+
+struct MeshCacheLod {
+    std::uint64_t nindices;
+    double error;
+};
+
+bool source_stamp(const std::string& filename, std::uint64_t& size, std::int64_t& mtime) {
+    std::error_code ec;
+    size = std::filesystem::file_size(filename, ec);
+    if (ec) return false;
+    mtime = std::filesystem::last_write_time(filename, ec).time_since_epoch().count();
+    return !ec;
+}
+
+struct ObjIndex {
+    int v, vt, vn; // 0-based, -1 when absent
+    bool operator==(const ObjIndex&) const = default;
+};
+
+struct ObjIndexHash {
+    size_t operator()(const ObjIndex& i) const {
+        size_t h = static_cast<unsigned>(i.v);
+        h = h * 0x9E3779B97F4A7C15ull ^ static_cast<unsigned>(i.vt);
+        h = h * 0x9E3779B97F4A7C15ull ^ static_cast<unsigned>(i.vn);
+        return h ^ (h >> 29);
+    }
+};
+
+// cursor over one line of the mapped file, never reads past end
+struct ObjCursor {
+    const char* p;
+    const char* end;
+
+    void skip_blank() { while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++; }
+    [[nodiscard]] bool at_end() { skip_blank(); return p >= end; }
+
+    bool read_double(double& value) {
+        skip_blank();
+        if (p < end && *p == '+') p++;
+        auto [next, ec] = std::from_chars(p, end, value);
+        if (ec != std::errc()) return false;
+        p = next;
+        return true;
+    }
+
+    bool read_int(int& value) {
+        if (p < end && *p == '+') p++;
+        auto [next, ec] = std::from_chars(p, end, value);
+        if (ec != std::errc()) return false;
+        p = next;
+        return true;
+    }
+
+    // one "v", "v/vt", "v//vn" or "v/vt/vn" group, indices resolved against the counts seen so far
+    bool read_index(ObjIndex& index, int nv, int nvt, int nvn) {
+        skip_blank();
+        int raw[3] = {0, 0, 0};
+        if (!read_int(raw[0])) return false;
+        for (int k = 1; k < 3 && p < end && *p == '/'; k++) {
+            p++;
+            if (p < end && *p != '/' && !read_int(raw[k])) return false;
         }
+        // 1-based, negative values count back from the last element read; 0 is an absent vt or vn, and a negative
+        // value reaching past the first element is out of range like a positive one past the last
+        auto resolve = [](int i, int n) { return i > 0 ? i - 1 : (i < 0 ? n + i : -1); };
+        index = {resolve(raw[0], nv), resolve(raw[1], nvt), resolve(raw[2], nvn)};
+        return index.v >= 0 && index.v < nv && (raw[1] == 0 || index.vt >= 0) && index.vt < nvt &&
+               (raw[2] == 0 || index.vn >= 0) && index.vn < nvn;
     }
+};
+
+}
+
+Model::Model(std::string filename, bool use_cache, bool optimize) {
+    const std::string cache_filename = filename + (optimize ? ".mesh" : ".unoptimized.mesh");
+    if (!use_cache || !load_cache(filename, cache_filename, optimize)) {
+        if (!load_obj(filename)) {
+            std::cerr << "can't load model " << filename << "\n";
+            return;
+        }
+        if (optimize) optimize_storage();
+        bind_storage();
+        if (use_cache && !write_cache(filename, cache_filename, optimize))
+            std::cerr << "can't write mesh cache " << cache_filename << "\n";
+    }
+    for (const vec3& v : vertices) bounds.extend(v);
+    clusters = build_clusters(vertices, faces);
+}
+
+void Model::bind_storage() {
+    vertices = vertex_storage;
+    texcoords = texcoord_storage;
+    normals = normal_storage;
+    faces = face_storage;
+    lods = {{faces, 0.}};
+    for (const LevelOfDetail& lod : lod_storage) lods.push_back({lod.indices, lod.error});
+}
+
+// the cache holds the mesh after optimize_storage() when optimized, each setting has its own file
+bool Model::load_cache(const std::string& filename, const std::string& cache_filename, bool optimized) {
+    MeshCacheHeader expected;
+    expected.optimized = optimized;
+    if (!source_stamp(filename, expected.source_size, expected.source_mtime))
+        return false;
+    auto file = std::make_unique<MappedFile>(cache_filename);
+    if (!file->is_open() || file->size() < sizeof(MeshCacheHeader))
+        return false;
+    MeshCacheHeader header;
+    memcpy(&header, file->data(), sizeof(header));
+    if (header.magic != expected.magic || header.version != expected.version || header.optimized != expected.optimized ||
+        header.source_size != expected.source_size || header.source_mtime != expected.source_mtime)
+        return false;
+    // every count is bounded by the file size before it is multiplied, so a corrupt header can't overflow the
+    // size computations or the allocation below
+    const size_t size = file->size();
+    const size_t nv = header.nvertices, ni = header.nindices;
+    if (nv > size / (sizeof(vec3) + sizeof(vec2) + sizeof(vec3)) || nv > static_cast<size_t>(std::numeric_limits<int>::max()) ||
+        ni > size / sizeof(int) || ni % 3 != 0 || header.nlods > size / sizeof(MeshCacheLod))
+        return false;
+    const size_t lod_table = sizeof(header) + nv * (sizeof(vec3) + sizeof(vec2) + sizeof(vec3)) + ni * sizeof(int);
+    size_t expected_size = lod_table + header.nlods * sizeof(MeshCacheLod);
+    if (size < expected_size)
+        return false;
+    std::vector<MeshCacheLod> lod_headers(header.nlods);
+    memcpy(lod_headers.data(), file->data() + lod_table, lod_headers.size() * sizeof(MeshCacheLod));
+    for (const MeshCacheLod& lod : lod_headers) {
+        if (lod.nindices > (size - expected_size) / sizeof(int) || lod.nindices % 3 != 0)
+            return false;
+        expected_size += lod.nindices * sizeof(int);
+    }
+    if (size != expected_size)
+        return false;
+
+    // the vertex stage indexes with the faces unchecked, a cache with an index out of range is rebuilt from the .obj
+    const auto in_range = [nv](const char* at, size_t count) {
+        const int* indices = reinterpret_cast<const int*>(at);
+        return std::all_of(indices, indices + count, [nv](int i) { return i >= 0 && static_cast<size_t>(i) < nv; });
+    };
+    const size_t lod_indices = lod_table + lod_headers.size() * sizeof(MeshCacheLod);
+    if (!in_range(file->data() + lod_table - ni * sizeof(int), ni) ||
+        !in_range(file->data() + lod_indices, (size - lod_indices) / sizeof(int)))
+        return false;
+
+    // the arrays are used in place, the mapping is page aligned and every array is aligned for its element type
+    const char* p = file->data() + sizeof(header);
+    vertices = {reinterpret_cast<const vec3*>(p), nv};
+    p += nv * sizeof(vec3);
+    texcoords = {reinterpret_cast<const vec2*>(p), nv};
+    p += nv * sizeof(vec2);
+    normals = {reinterpret_cast<const vec3*>(p), nv};
+    p += nv * sizeof(vec3);
+    faces = {reinterpret_cast<const int*>(p), ni};
+    p += ni * sizeof(int) + lod_headers.size() * sizeof(MeshCacheLod);
+    lods = {{faces, 0.}};
+    for (const MeshCacheLod& lod : lod_headers) {
+        lods.push_back({{reinterpret_cast<const int*>(p), lod.nindices}, lod.error});
+        p += lod.nindices * sizeof(int);
+    }
+    cache = std::move(file);
+    return true;
+}
+
+bool Model::write_cache(const std::string& filename, const std::string& cache_filename, bool optimized) const {
+    MeshCacheHeader header;
+    header.optimized = optimized;
+    if (!source_stamp(filename, header.source_size, header.source_mtime))
+        return false;
+    header.nvertices = vertices.size();
+    header.nindices = faces.size();
+    header.nlods = lods.size() - 1;
+    // written next to the cache and renamed over it, so a process that has the old cache mapped keeps reading the
+    // old file and a write that fails halfway never leaves a truncated cache behind
+    const std::string temp_filename = cache_filename + "." + std::to_string(std::random_device()()) + ".tmp";
+    std::ofstream out(temp_filename, std::ios::binary);
+    if (!out.is_open())
+        return false;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(vertices.data()), vertices.size_bytes());
+    out.write(reinterpret_cast<const char*>(texcoords.data()), texcoords.size_bytes());
+    out.write(reinterpret_cast<const char*>(normals.data()), normals.size_bytes());
+    out.write(reinterpret_cast<const char*>(faces.data()), faces.size_bytes());
+    for (size_t i = 1; i < lods.size(); i++) {
+        const MeshCacheLod lod {lods[i].faces.size(), lods[i].error};
+        out.write(reinterpret_cast<const char*>(&lod), sizeof(lod));
+    }
+    for (size_t i = 1; i < lods.size(); i++)
+        out.write(reinterpret_cast<const char*>(lods[i].faces.data()), lods[i].faces.size_bytes());
+    out.close();
+    std::error_code ec;
+    if (out.good())
+        std::filesystem::rename(temp_filename, cache_filename, ec);
+    if (!out.good() || ec) {
+        std::filesystem::remove(temp_filename, ec);
+        return false;
+    }
+    return true;
+}
+
+// vertex cache order first, then the overdraw order built from its runs, then the vertices renumbered to match;
+// the levels of detail are simplified from the result and reordered the same way, they share its vertices
+void Model::optimize_storage() {
+    const int nvertex = static_cast<int>(vertex_storage.size());
+    face_storage = optimize_vertex_cache(face_storage, nvertex);
+    face_storage = optimize_overdraw(vertex_storage, face_storage);
+    const std::vector<int> remap = optimize_vertex_fetch(face_storage, nvertex);
+    for (int& v : face_storage) v = remap[v];
+    vertex_storage = remap_vertices<vec3>(vertex_storage, remap);
+    texcoord_storage = remap_vertices<vec2>(texcoord_storage, remap);
+    normal_storage = remap_vertices<vec3>(normal_storage, remap);
+    lod_storage = build_lods(vertex_storage, face_storage);
+    for (LevelOfDetail& lod : lod_storage) {
+        lod.indices = optimize_vertex_cache(lod.indices, nvertex);
+        lod.indices = optimize_overdraw(vertex_storage, lod.indices);
+    }
+}
+
+bool Model::load_obj(const std::string& filename) {
+    MappedFile file(filename);
+    if (!file.is_open())
+        return false;
+
+    std::vector<vec3> positions, obj_normals;
+    std::vector<vec2> uvs;
+    std::unordered_map<ObjIndex, int, ObjIndexHash> unique;
+    std::vector<int> polygon;
+
+    const char* p = file.data();
+    const char* const end = p + file.size();
+    int line_number = 0;
+    while (p < end) {
+        const char* eol = p;
+        while (eol < end && *eol != '\n') eol++;
+        line_number++;
+        ObjCursor line {p, eol};
+        p = eol + 1;
+
+        line.skip_blank();
+        if (line.p + 1 >= line.end) continue;
+        const char c0 = line.p[0], c1 = line.p[1];
+        bool ok = true;
+        if (c0 == 'v' && (c1 == ' ' || c1 == '\t')) {
+            line.p += 2;
+            vec3 v;
+            ok = line.read_double(v.x) && line.read_double(v.y) && line.read_double(v.z);
+            if (ok) positions.push_back(v);
+        } else if (c0 == 'v' && c1 == 't') {
+            line.p += 2;
+            vec2 uv;
+            ok = line.read_double(uv.x);
+            if (ok && !line.at_end()) ok = line.read_double(uv.y);
+            if (ok) uvs.push_back(uv);
+        } else if (c0 == 'v' && c1 == 'n') {
+            line.p += 2;
+            vec3 n;
+            ok = line.read_double(n.x) && line.read_double(n.y) && line.read_double(n.z);
+            if (ok) obj_normals.push_back(n);
+        } else if (c0 == 'f' && (c1 == ' ' || c1 == '\t')) {
+            line.p += 2;
+            polygon.clear();
+            while (ok && !line.at_end()) {
+                ObjIndex index {};
+                ok = line.read_index(index, positions.size(), uvs.size(), obj_normals.size());
+                if (!ok) break;
+                auto [it, inserted] = unique.try_emplace(index, static_cast<int>(vertex_storage.size()));
+                if (inserted) {
+                    vertex_storage.push_back(positions[index.v]);
+                    texcoord_storage.push_back(index.vt >= 0 ? uvs[index.vt] : vec2());
+                    normal_storage.push_back(index.vn >= 0 ? obj_normals[index.vn] : vec3());
+                }
+                polygon.push_back(it->second);
+            }
+            for (size_t i = 1; ok && i + 1 < polygon.size(); i++) {
+                face_storage.push_back(polygon[0]);
+                face_storage.push_back(polygon[i]);
+                face_storage.push_back(polygon[i + 1]);
+            }
+        }
+        if (!ok)
+            std::cerr << filename << ":" << line_number << ": malformed line skipped\n";
+    }
+    return true;
 }
 
 int Model::getNumberVertex() const {
@@ -44,3 +332,11 @@ vec3 Model::getVertex(int index) const {
 vec3 Model::getVertex(int face_index, int vertex_index) const {
     return vertices[faces[face_index * 3 + vertex_index]];
 }
+
+vec2 Model::getTexcoord(int index) const {
+    return texcoords[index];
+}
+
+vec3 Model::getNormal(int index) const {
+    return normals[index];
+}
@@ -4,19 +4,57 @@
 
 #ifndef MODEL_H
 #define MODEL_H
+#include <memory>
+#include <span>
+#include <string>
 #include <vector>
+#include "bounds.h"
 #include "geometry.h"
+#include "mappedfile.h"
+#include "simplify.h"
 
 class Model {
 public:
-    std::vector<vec3> vertices;
-    std::vector<int> faces;
+    // one entry per distinct v/vt/vn triple referenced by the faces,
+    // backed either by the parsed .obj or by a memory-mapped binary cache
+    std::span<const vec3> vertices;
+    std::span<const vec2> texcoords; // zero where the face gives no vt
+    std::span<const vec3> normals;   // zero where the face gives no vn
+    std::span<const int> faces;      // each 3 int is a triangle, polygons are split into fans
+    // coarser versions of faces over the same vertices, lods[0] is faces itself; built with optimize
+    struct Lod {
+        std::span<const int> faces;
+        double error; // bound on the distance from any full detail vertex to this surface, in model units
+    };
+    std::vector<Lod> lods;
+    // computed at load time for culling
+    AABB bounds;
+    std::vector<Cluster> clusters;
 
-    explicit Model(std::string filename);
+    // with use_cache the parsed mesh is stored in filename + ".mesh" (".unoptimized.mesh" without optimize) and
+    // mapped on later runs, the cache is rebuilt whenever the size or modification time of the .obj changes;
+    // with optimize the faces and vertices are reordered for the vertex cache and overdraw, see optimize.h,
+    // and the levels of detail are built, see simplify.h
+    explicit Model(std::string filename, bool use_cache = true, bool optimize = true);
     int getNumberVertex() const;
     int getNumberFace() const;
     vec3 getVertex(int index) const;
     vec3 getVertex(int face_index, int vertex_index) const;
+    vec2 getTexcoord(int index) const;
+    vec3 getNormal(int index) const;
+private:
+    bool load_obj(const std::string& filename);
+    bool load_cache(const std::string& filename, const std::string& cache_filename, bool optimized);
+    bool write_cache(const std::string& filename, const std::string& cache_filename, bool optimized) const;
+    void optimize_storage();
+    void bind_storage();
+
+    std::vector<vec3> vertex_storage;
+    std::vector<vec2> texcoord_storage;
+    std::vector<vec3> normal_storage;
+    std::vector<int> face_storage;
+    std::vector<LevelOfDetail> lod_storage;
+    std::unique_ptr<MappedFile> cache;
 };
 
-#endif //MODEL_H
\ No newline at end of file
+#endif //MODEL_H
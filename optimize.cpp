@@ -0,0 +1,167 @@
+//
+// Created by laoe on 25-9-30.
+//
+
+#include <algorithm>
+#include <numeric>
+
+#include "optimize.h"
+
+namespace {
+
+// FIFO cache of vertex indices, a vertex enters when it misses and leaves cache_size misses later
+class FifoCache {
+public:
+    FifoCache(int vertex_count, int cache_size) : entered(vertex_count, -1), cache_size(cache_size) {}
+    // true on a miss
+    bool access(int v) {
+        if (entered[v] >= 0 && misses - entered[v] < cache_size)
+            return false;
+        entered[v] = misses++;
+        return true;
+    }
+    void flush() { misses += cache_size; }
+private:
+    std::vector<int> entered;
+    int misses = 0;
+    int cache_size;
+};
+
+int vertex_bound(std::span<const int> indices) {
+    return indices.empty() ? 0 : *std::max_element(indices.begin(), indices.end()) + 1;
+}
+
+}
+
+double acmr(std::span<const int> indices, int cache_size) {
+    const size_t nface = indices.size() / 3;
+    if (nface == 0)
+        return 0;
+    FifoCache cache(vertex_bound(indices), cache_size);
+    size_t misses = 0;
+    for (size_t i = 0; i < nface * 3; i++) misses += cache.access(indices[i]);
+    return static_cast<double>(misses) / nface;
+}
+
+std::vector<int> optimize_vertex_cache(std::span<const int> indices, int vertex_count, int cache_size) {
+    const int nface = static_cast<int>(indices.size() / 3);
+    // triangles around every vertex, as offsets into one array
+    std::vector<int> live(vertex_count, 0), offsets(vertex_count + 1, 0), adjacency(nface * 3);
+    for (int i = 0; i < nface * 3; i++) live[indices[i]]++;
+    std::partial_sum(live.begin(), live.end(), offsets.begin() + 1);
+    std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+    for (int i = 0; i < nface * 3; i++) adjacency[fill[indices[i]]++] = i / 3;
+
+    std::vector<int> timestamp(vertex_count, 0), dead_end, candidates, result;
+    std::vector<char> emitted(nface, 0);
+    result.reserve(nface * 3);
+    int time = cache_size + 1, cursor = 0;
+    int fanning = nface > 0 ? indices[0] : -1;
+    while (fanning >= 0) {
+        // emit every remaining triangle around the fanning vertex
+        candidates.clear();
+        for (int k = offsets[fanning]; k < offsets[fanning + 1]; k++) {
+            const int t = adjacency[k];
+            if (emitted[t]) continue;
+            emitted[t] = 1;
+            for (int j = 0; j < 3; j++) {
+                const int v = indices[t * 3 + j];
+                result.push_back(v);
+                dead_end.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (time - timestamp[v] > cache_size) timestamp[v] = time++;
+            }
+        }
+
+        // next fanning vertex: the oldest candidate that stays in the cache while its remaining triangles are emitted
+        fanning = -1;
+        int best = 0;
+        for (int v : candidates) {
+            if (live[v] <= 0) continue;
+            const int priority = time - timestamp[v] + 2 * live[v] <= cache_size ? time - timestamp[v] : 0;
+            if (priority > best) best = priority, fanning = v;
+        }
+        if (fanning >= 0) continue;
+        // dead end: the most recent vertex with triangles left, else the next one in input order
+        while (!dead_end.empty() && fanning < 0) {
+            if (live[dead_end.back()] > 0) fanning = dead_end.back();
+            dead_end.pop_back();
+        }
+        while (fanning < 0 && cursor < vertex_count) {
+            if (live[cursor] > 0) fanning = cursor;
+            cursor++;
+        }
+    }
+    return result;
+}
+
+std::vector<int> optimize_overdraw(std::span<const vec3> vertices, std::span<const int> indices, double threshold,
+                                   int cache_size) {
+    const int nface = static_cast<int>(indices.size() / 3);
+    const int vertex_count = static_cast<int>(vertices.size());
+    const double limit = acmr(indices, cache_size) * threshold;
+
+    // runs: [starts[i], starts[i + 1]) in faces
+    std::vector<int> starts {0};
+    FifoCache cache(vertex_count, cache_size);
+    int misses = 0;
+    for (int i = 0; i < nface; i++) {
+        const int length = i - starts.back();
+        if (length > 0 && misses <= limit * length) {
+            starts.push_back(i);
+            cache.flush();
+            misses = 0;
+        }
+        for (int j = 0; j < 3; j++) misses += cache.access(indices[i * 3 + j]);
+    }
+    starts.push_back(nface);
+
+    // area weighted centroid and normal of every run, and of the mesh
+    struct Run {
+        int first, count;
+        vec3 centroid, normal;
+        double area;
+        double key;
+    };
+    std::vector<Run> runs;
+    vec3 center;
+    double total_area = 0;
+    for (size_t r = 0; r + 1 < starts.size(); r++) {
+        Run run {starts[r], starts[r + 1] - starts[r], {}, {}, 0, 0};
+        for (int i = run.first; i < run.first + run.count; i++) {
+            const vec3 &a = vertices[indices[i * 3]], &b = vertices[indices[i * 3 + 1]], &c = vertices[indices[i * 3 + 2]];
+            const vec3 n = (b - a) ^ (c - a);
+            const double area = norm(n) / 2;
+            run.centroid = run.centroid + (a + b + c) * (area / 3);
+            run.normal = run.normal + n;
+            run.area += area;
+        }
+        center = center + run.centroid;
+        total_area += run.area;
+        if (run.area > 0) run.centroid = run.centroid / run.area;
+        runs.push_back(run);
+    }
+    if (total_area > 0) center = center / total_area;
+    for (Run& run : runs) {
+        const double length = norm(run.normal);
+        run.key = length > 0 ? (run.centroid - center) * run.normal / length : 0;
+    }
+    std::stable_sort(runs.begin(), runs.end(), [](const Run& a, const Run& b) { return a.key > b.key; });
+
+    std::vector<int> result;
+    result.reserve(nface * 3);
+    for (const Run& run : runs)
+        result.insert(result.end(), indices.begin() + run.first * 3, indices.begin() + (run.first + run.count) * 3);
+    return result;
+}
+
+std::vector<int> optimize_vertex_fetch(std::span<const int> indices, int vertex_count) {
+    std::vector<int> remap(vertex_count, -1);
+    int next = 0;
+    for (int v : indices)
+        if (remap[v] < 0) remap[v] = next++;
+    for (int& v : remap)
+        if (v < 0) v = next++;
+    return remap;
+}
@@ -0,0 +1,45 @@
+//
+// Created by laoe on 25-9-30.
+//
+
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+#include <span>
+#include <vector>
+
+#include "geometry.h"
+
+// Load time reordering of indexed triangle lists. None of them changes the set of triangles or their winding,
+// only the order they are drawn in and the order their vertices are stored in.
+
+// size of the FIFO post-transform cache the face order is optimised for and acmr() simulates
+constexpr int vertex_cache_size = 16;
+
+// average cache miss ratio: vertices transformed per triangle with a FIFO cache of cache_size entries,
+// between 0.5 for an ideal order of a large regular mesh and 3
+double acmr(std::span<const int> indices, int cache_size = vertex_cache_size);
+
+// Tipsify (Sander et al. 2007): fans out around recently used vertices, keeping the triangles of each vertex
+// close together in the order
+std::vector<int> optimize_vertex_cache(std::span<const int> indices, int vertex_count, int cache_size = vertex_cache_size);
+
+// Cuts a cache optimised order into runs wherever a run started on a cold cache would cost at most threshold
+// times the whole order's acmr, then sorts the runs so the ones on the outside of the mesh, facing away from its
+// center, come first. They are the likeliest to occlude the rest from any direction, so early depth rejection
+// catches more of what is drawn after them.
+std::vector<int> optimize_overdraw(std::span<const vec3> vertices, std::span<const int> indices, double threshold = 1.05,
+                                   int cache_size = vertex_cache_size);
+
+// new index of every vertex, numbering them in order of first use so the vertices of neighbouring triangles are
+// stored together; vertices no face uses go to the end
+std::vector<int> optimize_vertex_fetch(std::span<const int> indices, int vertex_count);
+
+// applies a remap from optimize_vertex_fetch to a per-vertex array
+template<typename T>
+std::vector<T> remap_vertices(std::span<const T> values, std::span<const int> remap) {
+    std::vector<T> result(values.size());
+    for (size_t i = 0; i < values.size(); i++) result[remap[i]] = values[i];
+    return result;
+}
+
+#endif //OPTIMIZE_H
@@ -0,0 +1,45 @@
+//
+// Created by laoe on 25-9-29.
+//
+
+#include <algorithm>
+
+#include "scene.h"
+
+int Scene::add(const Mesh& mesh, const mat4& transform) {
+    objects.push_back({&mesh, transform, mesh.get_bounds().transformed(transform)});
+    return static_cast<int>(objects.size()) - 1;
+}
+
+void Scene::build() {
+    order.resize(objects.size());
+    for (int i = 0; i < size(); i++) order[i] = i;
+    nodes.clear();
+    nodes.reserve(objects.size() * 2);
+    if (!objects.empty()) build_node(0, size());
+}
+
+// top down, the objects are split at the median of their centers along the longest axis of the centers' bounds
+int Scene::build_node(int first, int count) {
+    const int index = static_cast<int>(nodes.size());
+    nodes.push_back({{}, first, count});
+    AABB box, centers;
+    for (int i = first; i < first + count; i++) {
+        box.extend(objects[order[i]].box);
+        if (!objects[order[i]].box.empty()) centers.extend(objects[order[i]].box.center());
+    }
+    nodes[index].box = box;
+    if (count <= leaf_objects || centers.empty())
+        return index;
+
+    const vec3 extent = centers.max - centers.min;
+    const int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : extent.y >= extent.z ? 1 : 2;
+    const int half = count / 2;
+    std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count,
+                     [&](int a, int b) { return objects[a].box.center()[axis] < objects[b].box.center()[axis]; });
+    const int left = build_node(first, half);
+    const int right = build_node(first + half, count - half);
+    nodes[index].left = left;
+    nodes[index].right = right;
+    return index;
+}
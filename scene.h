@@ -0,0 +1,80 @@
+//
+// Created by laoe on 25-9-29.
+//
+
+#ifndef SCENE_H
+#define SCENE_H
+#include <utility>
+#include <vector>
+
+#include "bounds.h"
+#include "geometry.h"
+#include "mesh.h"
+#include "Rasterizer.h"
+
+// The objects of a frame under a bounding volume hierarchy of their world space boxes. traverse() rejects whole
+// subtrees with one frustum and hi-z test and hands the rest out front to back, so the objects drawn first fill
+// the hi-z that culls the ones behind them. Meshes are held by pointer and must outlive the scene.
+class Scene {
+public:
+    // returns the id traverse() reports the object by
+    int add(const Mesh& mesh, const mat4& transform);
+    // call after the last add(), before traverse()
+    void build();
+    // calls draw(id) for every object whose node is not culled, the nearest first
+    template<typename F> void traverse(Rasterizer& rasterizer, const vec3& camera, F&& draw) const;
+
+    [[nodiscard]] int size() const { return static_cast<int>(objects.size()); }
+    [[nodiscard]] const Mesh& get_mesh(int id) const { return *objects[id].mesh; }
+    [[nodiscard]] const mat4& get_transform(int id) const { return objects[id].transform; }
+    [[nodiscard]] const AABB& get_box(int id) const { return objects[id].box; }
+    [[nodiscard]] AABB get_bounds() const { return nodes.empty() ? AABB{} : nodes[0].box; }
+private:
+    static constexpr int leaf_objects = 2;
+
+    struct Object {
+        const Mesh* mesh;
+        mat4 transform;
+        AABB box; // world space
+    };
+    struct Node {
+        AABB box;
+        int first, count;  // leaves: the objects order[first, first + count)
+        int left = -1, right = -1;
+    };
+
+    int build_node(int first, int count);
+
+    std::vector<Object> objects;
+    std::vector<int> order;
+    std::vector<Node> nodes; // nodes[0] is the root
+};
+
+template<typename F>
+void Scene::traverse(Rasterizer& rasterizer, const vec3& camera, F&& draw) const {
+    if (nodes.empty())
+        return;
+    const mat4 world = identity_matrix<4>();
+    auto distance = [&](const Node& node) {
+        const vec3 d = node.box.center() - camera;
+        return d * d;
+    };
+    std::vector<int> stack {0};
+    while (!stack.empty()) {
+        const Node& node = nodes[stack.back()];
+        stack.pop_back();
+        if (!rasterizer.is_box_visible(node.box, world))
+            continue;
+        if (node.left < 0) {
+            for (int i = node.first; i < node.first + node.count; i++) draw(order[i]);
+            continue;
+        }
+        // the farther child goes first on the stack so the nearer one is drawn first
+        int near_child = node.left, far_child = node.right;
+        if (distance(nodes[far_child]) < distance(nodes[near_child])) std::swap(near_child, far_child);
+        stack.push_back(far_child);
+        stack.push_back(near_child);
+    }
+}
+
+#endif //SCENE_H
@@ -0,0 +1,96 @@
+//
+// Created by laoe on 25-10-2.
+//
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "instrument.h"
+#include "sequence.h"
+
+bool CameraPath::load(const std::string& filename) {
+    std::ifstream in(filename);
+    if (!in.is_open()) {
+        std::cerr << "can't open camera path " << filename << "\n";
+        return false;
+    }
+    keys.clear();
+    std::string line;
+    for (int line_number = 1; std::getline(in, line); line_number++) {
+        const size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#') continue;
+        std::istringstream fields(line);
+        Key key;
+        if (!(fields >> key.eye.x >> key.eye.y >> key.eye.z >> key.center.x >> key.center.y >> key.center.z)) {
+            std::cerr << filename << ":" << line_number << ": expected eye.x eye.y eye.z center.x center.y center.z\n";
+            return false;
+        }
+        keys.push_back(key);
+    }
+    if (keys.empty()) {
+        std::cerr << "camera path " << filename << " has no keys\n";
+        return false;
+    }
+    return true;
+}
+
+CameraPath::Key CameraPath::at(int i, int frames) const {
+    if (keys.size() == 1 || frames < 2)
+        return keys[0];
+    const double t = static_cast<double>(i) / (frames - 1) * (keys.size() - 1);
+    const int k = std::min(static_cast<int>(t), static_cast<int>(keys.size()) - 2);
+    const double f = t - k;
+    return {keys[k].eye * (1 - f) + keys[k + 1].eye * f, keys[k].center * (1 - f) + keys[k + 1].center * f};
+}
+
+FrameWriter::FrameWriter(int max_pending) : max_pending(std::max(1, max_pending)), worker(&FrameWriter::run, this) {}
+
+FrameWriter::~FrameWriter() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    changed.notify_all();
+    worker.join();
+}
+
+void FrameWriter::submit(TGAImage image, std::string filename) {
+    std::unique_lock lock(mutex);
+    changed.wait(lock, [&] { return static_cast<int>(queue.size()) < max_pending; });
+    queue.emplace_back(std::move(image), std::move(filename));
+    changed.notify_all();
+}
+
+bool FrameWriter::finish() {
+    std::unique_lock lock(mutex);
+    changed.wait(lock, [&] { return queue.empty() && writing == 0; });
+    return !failed;
+}
+
+void FrameWriter::run() {
+    std::unique_lock lock(mutex);
+    while (true) {
+        changed.wait(lock, [&] { return stopping || !queue.empty(); });
+        if (queue.empty())
+            return;
+        auto [image, filename] = std::move(queue.front());
+        queue.pop_front();
+        writing++;
+        changed.notify_all();
+
+        lock.unlock();
+        bool ok;
+        {
+            MR_TRACE_SCOPE("write frame"); // ends before finish() can see the frame written
+            ok = image.write_tga_file(filename);
+        }
+        if (!ok) std::cerr << "can't write " << filename << "\n";
+        lock.lock();
+
+        failed |= !ok;
+        writing--;
+        changed.notify_all();
+    }
+}
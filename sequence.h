@@ -0,0 +1,60 @@
+//
+// Created by laoe on 25-10-2.
+//
+
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "geometry.h"
+#include "tgaimage.h"
+
+// Camera keyframes for rendering a sequence, read from a text file with one key per line:
+//   eye.x eye.y eye.z center.x center.y center.z
+// Blank lines and lines starting with # are skipped.
+class CameraPath {
+public:
+    struct Key {
+        vec3 eye, center;
+    };
+
+    bool load(const std::string& filename);
+    [[nodiscard]] int size() const { return static_cast<int>(keys.size()); }
+    // frame i of a sequence of frames frames spread evenly over the path, linear between the keys
+    [[nodiscard]] Key at(int i, int frames) const;
+private:
+    std::vector<Key> keys;
+};
+
+// Encodes and writes frames on a background thread, so writing frame N overlaps rendering frame N + 1.
+// At most max_pending frames wait to be written, submit() blocks while the queue is full.
+class FrameWriter {
+public:
+    explicit FrameWriter(int max_pending = 2);
+    ~FrameWriter();
+    FrameWriter(const FrameWriter&) = delete;
+    FrameWriter& operator=(const FrameWriter&) = delete;
+
+    void submit(TGAImage image, std::string filename);
+    // waits until every submitted frame is written, false if any of them failed
+    bool finish();
+private:
+    void run();
+
+    int max_pending;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::pair<TGAImage, std::string>> queue;
+    int writing = 0;
+    bool stopping = false;
+    bool failed = false;
+    std::thread worker;
+};
+
+#endif //SEQUENCE_H
@@ -0,0 +1,232 @@
+//
+// Created by laoe on 25-10-5.
+//
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <thread>
+#include <type_traits>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "camera.h"
+#include "scene.h"
+#include "server.h"
+
+namespace {
+
+bool write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        const ssize_t n = write(fd, data, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n, size -= n;
+    }
+    return true;
+}
+
+std::string ok(const std::string& payload) {
+    return "ok " + std::to_string(payload.size()) + "\n" + payload;
+}
+
+std::string error(const std::string& message) {
+    return "error " + message + "\n";
+}
+
+}
+
+std::unique_ptr<Rasterizer> RasterizerPool::acquire(int width, int height) {
+    {
+        std::lock_guard lock(mutex);
+        for (auto it = idle.begin(); it != idle.end(); ++it) {
+            if (it->width != width || it->height != height) continue;
+            std::unique_ptr<Rasterizer> rasterizer = std::move(it->rasterizer);
+            idle_pixels -= static_cast<size_t>(width) * height;
+            idle.erase(it);
+            return rasterizer;
+        }
+    }
+    return std::make_unique<Rasterizer>(width, height);
+}
+
+void RasterizerPool::release(int width, int height, std::unique_ptr<Rasterizer> rasterizer) {
+    std::list<Idle> evicted; // freed after the lock is released
+    std::lock_guard lock(mutex);
+    idle.push_front({width, height, std::move(rasterizer)});
+    idle_pixels += static_cast<size_t>(width) * height;
+    while (idle_pixels > max_idle_pixels) {
+        idle_pixels -= static_cast<size_t>(idle.back().width) * idle.back().height;
+        evicted.splice(evicted.begin(), idle, std::prev(idle.end()));
+    }
+}
+
+RenderServer::RenderServer(const std::vector<std::string>& filenames, const Settings& settings)
+    : settings(settings), connection_slots(std::max(1, settings.max_connections)), render_slots(std::max(1, settings.max_renders)) {
+    for (const std::string& filename : filenames) {
+        Asset& asset = *assets.emplace_back(std::make_unique<Asset>(filename));
+        if (settings.shading == "flat") {
+            asset.shader.emplace(std::in_place_type<FaceNormalShader>, asset.mesh.get_vertices(), asset.mesh.get_indices());
+            continue;
+        }
+        asset.diffuse = load_model_texture(filename, "_diffuse");
+        asset.specular = load_model_texture(filename, "_spec");
+        if (settings.shading == "normal") asset.normal_map = load_model_texture(filename, "_nm_tangent");
+        Lighting lighting(settings.light, {0, 0, 0});
+        lighting.diffuse = asset.diffuse.empty() ? nullptr : &asset.diffuse;
+        lighting.specular = asset.specular.empty() ? nullptr : &asset.specular;
+        if (!asset.normal_map.empty())
+            asset.shader.emplace(std::in_place_type<NormalMapShader>, asset.model, lighting, asset.normal_map);
+        else
+            asset.shader.emplace(std::in_place_type<PhongShader>, asset.model, lighting);
+    }
+}
+
+void RenderServer::serve(int in, int out) {
+    std::string buffer;
+    char chunk[4096];
+    while (true) {
+        size_t end;
+        while ((end = buffer.find('\n')) == std::string::npos) {
+            if (buffer.size() > max_request) {
+                // no valid request is this long, the rest of the line can't be told from garbage either
+                const std::string response = error("request too long");
+                write_all(out, response.data(), response.size());
+                return;
+            }
+            const ssize_t n = read(in, chunk, sizeof(chunk));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            buffer.append(chunk, n);
+        }
+        std::string request = buffer.substr(0, end);
+        buffer.erase(0, end + 1);
+        if (!request.empty() && request.back() == '\r') request.pop_back();
+        if (request == "quit")
+            return;
+        if (request.empty())
+            continue;
+        const std::string response = respond(request);
+        if (!write_all(out, response.data(), response.size()))
+            return;
+    }
+}
+
+bool RenderServer::listen(const std::string& path) {
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "socket path too long: " << path << "\n";
+        return false;
+    }
+    std::strcpy(address.sun_path, path.c_str());
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        std::cerr << "can't create socket: " << std::strerror(errno) << "\n";
+        return false;
+    }
+    unlink(path.c_str()); // a socket file left over by an earlier server
+    if (bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0 || ::listen(fd, 16) < 0) {
+        std::cerr << "can't listen on " << path << ": " << std::strerror(errno) << "\n";
+        close(fd);
+        return false;
+    }
+    // a client hanging up mid-response must end its connection, not the server
+    std::signal(SIGPIPE, SIG_IGN);
+    while (true) {
+        // further clients queue in the listen backlog until a connection ends
+        connection_slots.acquire();
+        int connection;
+        while ((connection = accept(fd, nullptr, nullptr)) < 0 && (errno == EINTR || errno == ECONNABORTED)) {}
+        if (connection < 0) {
+            std::cerr << "can't accept on " << path << ": " << std::strerror(errno) << "\n";
+            connection_slots.release();
+            close(fd);
+            return false;
+        }
+        std::thread([this, connection] {
+            serve(connection, connection);
+            close(connection);
+            connection_slots.release();
+        }).detach();
+    }
+}
+
+std::string RenderServer::respond(const std::string& request) {
+    std::istringstream in(request);
+    std::string command;
+    in >> command;
+    if (command == "meshes") {
+        std::string list;
+        for (size_t i = 0; i < assets.size(); i++)
+            list += std::to_string(i) + " " + std::to_string(assets[i]->mesh.face_count()) + " " + assets[i]->filename + "\n";
+        return ok(list);
+    }
+    if (command != "render")
+        return error("unknown request " + command);
+
+    int width, height;
+    vec3 eye, center;
+    if (!(in >> width >> height >> eye.x >> eye.y >> eye.z >> center.x >> center.y >> center.z))
+        return error("expected render width height eye.x eye.y eye.z center.x center.y center.z [handle...]");
+    if (width < 1 || height < 1 || width > max_size || height > max_size)
+        return error("resolution out of range");
+    // the view matrix is undefined when the eye sits on center or looks along up
+    if (!(norm(settings.up ^ (eye - center)) > 0))
+        return error("eye must differ from center and not look along up");
+    std::vector<int> handles;
+    for (int handle; in >> handle; ) {
+        if (handle < 0 || handle >= static_cast<int>(assets.size()))
+            return error("no mesh " + std::to_string(handle));
+        handles.push_back(handle);
+    }
+    if (!in.eof())
+        return error("bad handle");
+    if (handles.empty()) {
+        for (int i = 0; i < static_cast<int>(assets.size()); i++) handles.push_back(i);
+    }
+    return ok(render(width, height, eye, center, handles));
+}
+
+// same camera and draw order as a frame of main, on a rasterizer of the pool
+std::string RenderServer::render(int width, int height, const vec3& eye, const vec3& center, const std::vector<int>& handles) {
+    render_slots.acquire();
+    std::unique_ptr<Rasterizer> rasterizer = pool.acquire(width, height);
+    if (rasterizer->get_samples() != settings.samples) rasterizer->set_samples(settings.samples);
+    rasterizer->set_view_matrix(view_matrix(eye, center, settings.up));
+    rasterizer->set_projection_matrix(perspective_projection(settings.fov, static_cast<double>(width) / height,
+                                                             settings.near, settings.far));
+    rasterizer->set_cull_mode(Rasterizer::CullMode::Back);
+    rasterizer->set_lod_error(settings.lod_error);
+    rasterizer->clear_targets();
+
+    Scene scene;
+    const mat4 transform = identity_matrix<4>();
+    for (int handle : handles) scene.add(assets[handle]->mesh, transform);
+    scene.build();
+    scene.traverse(*rasterizer, center, [&](int id) {
+        const Mesh& mesh = scene.get_mesh(id);
+        std::visit([&](const auto& shader) {
+            auto draw = [&](const auto& s) {
+                if (settings.deferred) rasterizer->draw_deferred(mesh, transform, s);
+                else rasterizer->draw(mesh, transform, s);
+            };
+            using S = std::decay_t<decltype(shader)>;
+            if constexpr (requires { &S::fragment_from; }) draw(EyeView<S> {shader, eye});
+            else draw(shader);
+        }, *assets[handles[id]]->shader);
+    });
+
+    TGAImage frame(width, height, TGAImage::RGB);
+    rasterizer->drawonTGA(frame);
+    pool.release(width, height, std::move(rasterizer));
+    render_slots.release();
+    const std::vector<std::uint8_t> encoded = frame.encode_tga();
+    return {encoded.begin(), encoded.end()};
+}
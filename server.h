@@ -0,0 +1,93 @@
+//
+// Created by laoe on 25-10-5.
+//
+
+#ifndef SERVER_H
+#define SERVER_H
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <semaphore>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "geometry.h"
+#include "mesh.h"
+#include "model.h"
+#include "Rasterizer.h"
+#include "shader.h"
+#include "texture.h"
+
+// Rasterizers kept across requests, so a request reuses the render targets and per-draw buffers of an earlier one of
+// the same size. The idle ones hold at most max_idle_pixels pixels in total across all resolutions, the least
+// recently released are freed first.
+class RasterizerPool {
+public:
+    explicit RasterizerPool(size_t max_idle_pixels = size_t{1} << 25) : max_idle_pixels(max_idle_pixels) {}
+    std::unique_ptr<Rasterizer> acquire(int width, int height);
+    void release(int width, int height, std::unique_ptr<Rasterizer> rasterizer);
+private:
+    struct Idle {
+        int width, height;
+        std::unique_ptr<Rasterizer> rasterizer;
+    };
+    size_t max_idle_pixels;
+    size_t idle_pixels = 0;
+    std::mutex mutex;
+    std::list<Idle> idle; // most recently released first
+};
+
+// Keeps a set of meshes loaded and renders requests against them. One request per line, every response is
+// "ok <n>\n" followed by n bytes of payload, or "error <message>\n":
+//   meshes                                                    one "<handle> <faces> <filename>\n" line per mesh
+//   render <width> <height> <eye x y z> <center x y z> [handle...]   the frame as a TGA file, of all meshes without handles
+//   quit                                                      ends the connection
+// Handles are the positions of the meshes in the filenames given to the constructor. Requests of one connection
+// are answered in order, up to max_connections connections are served concurrently. Every render already uses all
+// cores, so at most max_renders of them run at once and the others wait.
+class RenderServer {
+public:
+    struct Settings {
+        std::string shading = "flat"; // flat, phong or normal
+        bool deferred = false;
+        double lod_error = 0;
+        int samples = 1; // per pixel, see Rasterizer::set_samples
+        double fov = 150, near = 2, far = 3;
+        vec3 up {0, 1, 0};
+        vec3 light {1, 1, 1}; // direction towards the light
+        int max_connections = 64;
+        int max_renders = 1;
+    };
+    static constexpr int max_size = 8192; // largest width or height of a request
+    static constexpr size_t max_request = 4096; // longest request line, a longer one ends the connection
+
+    RenderServer(const std::vector<std::string>& filenames, const Settings& settings);
+    // answers the requests read from in on out until end of input or quit, e.g. serve(0, 1) for stdin and stdout
+    void serve(int in, int out);
+    // accepts connections on a Unix domain socket at path and serves each on its own thread, waiting for one to end
+    // while max_connections are open; returns only on error
+    bool listen(const std::string& path);
+    // the response to a single request line, without its newline
+    std::string respond(const std::string& request);
+private:
+    using Shader = std::variant<FaceNormalShader, PhongShader, NormalMapShader>;
+    struct Asset {
+        std::string filename;
+        Model model;
+        Mesh mesh;
+        Texture diffuse, specular, normal_map;
+        std::optional<Shader> shader; // shared by all requests, the lit ones are drawn through an EyeView
+        explicit Asset(const std::string& filename) : filename(filename), model(filename), mesh(model) {}
+    };
+
+    std::string render(int width, int height, const vec3& eye, const vec3& center, const std::vector<int>& handles);
+
+    Settings settings;
+    std::vector<std::unique_ptr<Asset>> assets;
+    RasterizerPool pool;
+    std::counting_semaphore<> connection_slots, render_slots;
+};
+
+#endif //SERVER_H
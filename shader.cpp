@@ -0,0 +1,82 @@
+//
+// Created by laoe on 25-9-26.
+//
+
+#include <filesystem>
+
+#include "shader.h"
+
+namespace {
+
+vec3 face_normal(std::span<const vec3> vertices, const int* idx) {
+    return (vertices[idx[1]] - vertices[idx[0]]) ^ (vertices[idx[2]] - vertices[idx[1]]);
+}
+
+// the model's normals, where the .obj gives none the area weighted normal of the adjacent faces
+std::vector<vec3> vertex_normals(const Model& model) {
+    std::vector<vec3> normals(model.normals.begin(), model.normals.end());
+    std::vector<vec3> accumulated(normals.size());
+    for (size_t i = 0; i + 2 < model.faces.size(); i += 3) {
+        const vec3 n = face_normal(model.vertices, &model.faces[i]);
+        for (int j = 0; j < 3; j++) accumulated[model.faces[i + j]] = accumulated[model.faces[i + j]] + n;
+    }
+    for (size_t i = 0; i < normals.size(); i++) {
+        if (normals[i] * normals[i] == 0) normals[i] = accumulated[i];
+        if (normals[i] * normals[i] == 0) normals[i] = {0, 0, 1};
+        normals[i] = normalize(normals[i]);
+    }
+    return normals;
+}
+
+}
+
+FaceNormalShader::FaceNormalShader(std::span<const vec3> vertices, std::span<const int> indices) {
+    face_colors.resize(indices.size() / 3);
+    for (size_t i = 0; i < face_colors.size(); i++) {
+        const vec3 n = normalize(face_normal(vertices, &indices[i * 3]));
+        face_colors[i] = vec3{n.x * 255, n.y * 255, n.z * 255}.to_color();
+    }
+}
+
+Lighting::Lighting(const vec3& light_dir, const vec3& eye) : light_dir(normalize(light_dir)), eye(eye) {}
+
+PhongShader::PhongShader(const Model& model, const Lighting& lighting)
+    : model(model), lighting(lighting), normals(vertex_normals(model)) {}
+
+NormalMapShader::NormalMapShader(const Model& model, const Lighting& lighting, const Texture& normal_map)
+    : model(model), lighting(lighting), normal_map(normal_map), normals(vertex_normals(model)) {
+    // per-face tangent frame from the uv gradients, accumulated on the vertices
+    tangents.resize(normals.size());
+    bitangents.resize(normals.size());
+    for (size_t i = 0; i + 2 < model.faces.size(); i += 3) {
+        const int* idx = &model.faces[i];
+        const vec3 e1 = model.vertices[idx[1]] - model.vertices[idx[0]], e2 = model.vertices[idx[2]] - model.vertices[idx[0]];
+        const vec2 d1 = model.texcoords[idx[1]] - model.texcoords[idx[0]], d2 = model.texcoords[idx[2]] - model.texcoords[idx[0]];
+        const double det = d1.x * d2.y - d2.x * d1.y;
+        if (std::abs(det) < 1e-12) continue;
+        const vec3 t = (e1 * d2.y - e2 * d1.y) / det;
+        const vec3 b = (e2 * d1.x - e1 * d2.x) / det;
+        for (int j = 0; j < 3; j++) {
+            tangents[idx[j]] = tangents[idx[j]] + t;
+            bitangents[idx[j]] = bitangents[idx[j]] + b;
+        }
+    }
+    // vertices without usable uvs get any frame around their normal, the map then only tilts it
+    for (size_t i = 0; i < normals.size(); i++) {
+        const vec3& n = normals[i];
+        if (norm(tangents[i] - n * (n * tangents[i])) < 1e-12)
+            tangents[i] = std::abs(n.x) < .9 ? vec3{1, 0, 0} ^ n : vec3{0, 1, 0} ^ n;
+        if (norm(bitangents[i] - n * (n * bitangents[i])) < 1e-12)
+            bitangents[i] = n ^ tangents[i];
+    }
+}
+
+Texture load_model_texture(const std::string& obj_filename, const std::string& suffix) {
+    const std::string filename = obj_filename.substr(0, obj_filename.rfind('.')) + suffix + ".tga";
+    if (!std::filesystem::exists(filename))
+        return {};
+    TGAImage image;
+    if (!image.read_tga_file(filename))
+        return {};
+    return Texture(image);
+}
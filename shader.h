@@ -0,0 +1,163 @@
+//
+// Created by laoe on 25-9-26.
+//
+
+#ifndef SHADER_H
+#define SHADER_H
+#include <algorithm>
+#include <cmath>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "geometry.h"
+#include "model.h"
+#include "Rasterizer.h"
+#include "shadow.h"
+#include "texture.h"
+#include "tgaimage.h"
+
+// Shaders for Rasterizer::draw. They hold their uniforms by value and the mesh data by reference,
+// so the model and the textures must outlive the draw.
+
+// flat shading, every face gets its object-space normal as color
+class FaceNormalShader {
+public:
+    struct Varyings {};
+
+    FaceNormalShader(std::span<const vec3> vertices, std::span<const int> indices);
+    Varyings vertex(int, const Rasterizer::Instance&) const { return {}; }
+    bool fragment(const Varyings&, const Rasterizer::Fragment& frag, TGAColor& color) const {
+        color = face_colors[frag.face];
+        return true;
+    }
+private:
+    std::vector<TGAColor> face_colors;
+};
+
+// Blinn-Phong lighting in world space, shared by the lit shaders
+struct Lighting {
+    vec3 light_dir;     // towards the light, normalized
+    vec3 eye;
+    const Texture* diffuse = nullptr;  // white when absent
+    const Texture* specular = nullptr; // specular intensity in the first channel, 0.5 when absent
+    const ShadowMap* shadow = nullptr; // fully lit when absent
+    double ambient = 0.15;
+    double shininess = 32;
+
+    Lighting(const vec3& light_dir, const vec3& eye);
+    static vec3 to_world(const Rasterizer::Instance& instance, const vec3& p) { return (instance.model * p.to_vec4(1.)).to_vec3(); }
+    static vec3 to_world_direction(const Rasterizer::Instance& instance, const vec3& d) {
+        const vec4 v = instance.model * d.to_vec4(0.);
+        return {v.x, v.y, v.z};
+    }
+    static vec3 to_world_normal(const Rasterizer::Instance& instance, const vec3& n) {
+        const vec4 v = instance.normal * n.to_vec4(0.);
+        return {v.x, v.y, v.z};
+    }
+
+    // duv_dx and duv_dy are the screen-space derivatives of uv, they pick the mip levels of the textures
+    [[nodiscard]] TGAColor shade(const vec3& n, const vec3& position, const vec2& uv, const vec2& duv_dx, const vec2& duv_dy) const {
+        return shade_from(eye, n, position, uv, duv_dx, duv_dy);
+    }
+    // seen from another eye than the stored one
+    [[nodiscard]] TGAColor shade_from(const vec3& from, const vec3& n, const vec3& position, const vec2& uv, const vec2& duv_dx,
+                                      const vec2& duv_dy) const {
+        const double facing = n * light_dir;
+        const double lit = shadow && facing > 0 ? shadow->visibility(position) : 1.;
+        const double diffuse_term = std::max(0., facing) * lit;
+        const vec3 h = normalize(light_dir + normalize(from - position));
+        const double specular_term = diffuse_term > 0 ? std::pow(std::max(0., n * h), shininess) * lit : 0;
+        const vec3 albedo = diffuse ? diffuse->sample(uv, duv_dx, duv_dy) : vec3{255, 255, 255};
+        const double ks = specular ? specular->sample(uv, duv_dx, duv_dy).x / 255. : .5;
+        return (albedo * (ambient + diffuse_term) + vec3{255, 255, 255} * (ks * specular_term)).to_color();
+    }
+};
+
+// per-vertex normals interpolated across the face
+class PhongShader {
+public:
+    struct Varyings {
+        vec3 normal;
+        vec3 position;
+        vec2 uv;
+    };
+
+    PhongShader(const Model& model, const Lighting& lighting);
+    void set_eye(const vec3& eye) { lighting.eye = eye; }
+    Varyings vertex(int index, const Rasterizer::Instance& instance) const {
+        return {Lighting::to_world_normal(instance, normals[index]), Lighting::to_world(instance, model.vertices[index]),
+                model.texcoords[index]};
+    }
+    bool fragment(const Varyings& in, const Rasterizer::Fragment&, const Rasterizer::Gradients<Varyings>& d, TGAColor& color) const {
+        return fragment_from(lighting.eye, in, d, color);
+    }
+    // the fragment stage seen from eye instead of the eye of the lighting, see EyeView
+    bool fragment_from(const vec3& eye, const Varyings& in, const Rasterizer::Gradients<Varyings>& d, TGAColor& color) const {
+        color = lighting.shade_from(eye, normalize(in.normal), in.position, in.uv, d.dx.uv, d.dy.uv);
+        return true;
+    }
+private:
+    const Model& model;
+    Lighting lighting;
+    std::vector<vec3> normals;
+};
+
+// tangent-space normal map, the tangent frame is interpolated and re-orthogonalised per pixel
+class NormalMapShader {
+public:
+    struct Varyings {
+        vec3 normal;
+        vec3 tangent;
+        vec3 bitangent;
+        vec3 position;
+        vec2 uv;
+    };
+
+    NormalMapShader(const Model& model, const Lighting& lighting, const Texture& normal_map);
+    void set_eye(const vec3& eye) { lighting.eye = eye; }
+    Varyings vertex(int index, const Rasterizer::Instance& instance) const {
+        return {Lighting::to_world_normal(instance, normals[index]), Lighting::to_world_direction(instance, tangents[index]),
+                Lighting::to_world_direction(instance, bitangents[index]), Lighting::to_world(instance, model.vertices[index]),
+                model.texcoords[index]};
+    }
+    bool fragment(const Varyings& in, const Rasterizer::Fragment&, const Rasterizer::Gradients<Varyings>& d, TGAColor& color) const {
+        return fragment_from(lighting.eye, in, d, color);
+    }
+    // the fragment stage seen from eye instead of the eye of the lighting, see EyeView
+    bool fragment_from(const vec3& eye, const Varyings& in, const Rasterizer::Gradients<Varyings>& d, TGAColor& color) const {
+        const vec3 n = normalize(in.normal);
+        const vec3 t = normalize(in.tangent - n * (n * in.tangent));
+        const vec3 b = normalize(in.bitangent - n * (n * in.bitangent) - t * (t * in.bitangent));
+        // the map stores x, y, z in r, g, b, sample() returns them as (b, g, r)
+        const vec3 texel = normal_map.sample(in.uv, d.dx.uv, d.dy.uv);
+        const vec3 m {texel.z / 127.5 - 1, texel.y / 127.5 - 1, texel.x / 127.5 - 1};
+        color = lighting.shade_from(eye, normalize(t * m.x + b * m.y + n * m.z), in.position, in.uv, d.dx.uv, d.dy.uv);
+        return true;
+    }
+private:
+    const Model& model;
+    Lighting lighting;
+    const Texture& normal_map;
+    std::vector<vec3> normals, tangents, bitangents;
+};
+
+// A lit shader drawn from an eye given per draw. It references the shader and its per-vertex data instead of copying
+// them to call set_eye, so one shader can be drawn from several eyes at once.
+template<typename Shader>
+struct EyeView {
+    using Varyings = typename Shader::Varyings;
+    const Shader& shader;
+    vec3 eye;
+
+    Varyings vertex(int index, const Rasterizer::Instance& instance) const { return shader.vertex(index, instance); }
+    bool fragment(const Varyings& in, const Rasterizer::Fragment&, const Rasterizer::Gradients<Varyings>& d, TGAColor& color) const {
+        return shader.fragment_from(eye, in, d, color);
+    }
+};
+
+// loads the texture stored next to an .obj by the bundled models' naming, e.g. suffix "_diffuse";
+// empty when the file does not exist
+Texture load_model_texture(const std::string& obj_filename, const std::string& suffix);
+
+#endif //SHADER_H
@@ -0,0 +1,68 @@
+//
+// Created by laoe on 25-9-27.
+//
+
+#include <algorithm>
+
+#include "shadow.h"
+
+ShadowMap::ShadowMap(int size, const vec3& light_dir, const vec3& bounds_min, const vec3& bounds_max)
+    : size(size), rasterizer(size, size) {
+    // light space: z along light_dir so nearer the light is larger, like the depth buffer
+    const vec3 z = normalize(light_dir);
+    const vec3 x = normalize(std::abs(z.y) < .99 ? vec3{0, 1, 0} ^ z : vec3{1, 0, 0} ^ z);
+    const vec3 y = z ^ x;
+    view = {{{x.x, x.y, x.z, 0},
+             {y.x, y.y, y.z, 0},
+             {z.x, z.y, z.z, 0},
+             {0,   0,   0,   1}}};
+
+    // fit the light-space bounds of the box corners into [-1, 1]^3
+    vec3 lo {1e30, 1e30, 1e30}, hi {-1e30, -1e30, -1e30};
+    for (int i = 0; i < 8; i++) {
+        const vec3 corner {i & 1 ? bounds_max.x : bounds_min.x, i & 2 ? bounds_max.y : bounds_min.y, i & 4 ? bounds_max.z : bounds_min.z};
+        const vec4 p = view * corner.to_vec4(1.);
+        for (int k = 0; k < 3; k++) {
+            lo[k] = std::min(lo[k], p[k]);
+            hi[k] = std::max(hi[k], p[k]);
+        }
+    }
+    projection = identity_matrix<4>();
+    for (int k = 0; k < 3; k++) {
+        const double extent = std::max(hi[k] - lo[k], 1e-9);
+        projection[k][k] = 2 / extent;
+        projection[k][3] = -(hi[k] + lo[k]) / extent;
+    }
+    const mat4 viewport {{{size/2., 0, 0, size/2.},
+                          {0, size/2., 0, size/2.},
+                          {0, 0, 1, 0},
+                          {0, 0, 0, 1}}};
+    light_matrix = viewport * projection * view;
+    clear();
+}
+
+void ShadowMap::clear() {
+    rasterizer.clear();
+    // casters keep their full detail, whatever level the shadowed geometry is drawn at
+    rasterizer.set_lod_error(0);
+    rasterizer.set_view_matrix(view);
+    rasterizer.set_projection_matrix(projection);
+}
+
+void ShadowMap::render(const Mesh& mesh, std::span<const mat4> models) {
+    rasterizer.draw_depth(mesh, models);
+}
+
+double ShadowMap::visibility(const vec3& p) const {
+    const vec4 s = light_matrix * p.to_vec4(1.);
+    const int cx = static_cast<int>(std::floor(s.x)), cy = static_cast<int>(std::floor(s.y));
+    int lit = 0, taps = 0;
+    for (int y = cy - pcf_radius; y <= cy + pcf_radius; y++) {
+        for (int x = cx - pcf_radius; x <= cx + pcf_radius; x++) {
+            taps++;
+            // outside the map nothing casts a shadow
+            if (x < 0 || y < 0 || x >= size || y >= size || rasterizer.get_depth(x, y) <= s.z + bias) lit++;
+        }
+    }
+    return static_cast<double>(lit) / taps;
+}
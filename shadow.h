@@ -0,0 +1,38 @@
+//
+// Created by laoe on 25-9-27.
+//
+
+#ifndef SHADOW_H
+#define SHADOW_H
+#include <span>
+
+#include "geometry.h"
+#include "mesh.h"
+#include "Rasterizer.h"
+
+// Shadow map of a directional light: depth of the occluders as seen along the light direction,
+// rendered with the depth-only path of Rasterizer through an orthographic projection fitted to a world-space box.
+class ShadowMap {
+public:
+    // light_dir points towards the light, [bounds_min, bounds_max] must contain every occluder and receiver
+    ShadowMap(int size, const vec3& light_dir, const vec3& bounds_min, const vec3& bounds_max);
+
+    // removes every occluder
+    void clear();
+    // adds the instances of mesh to the occluders
+    void render(const Mesh& mesh, std::span<const mat4> models);
+    void render(const Mesh& mesh, const mat4& model) { render(mesh, std::span(&model, 1)); }
+    // fraction of the light reaching world position p: 1 lit, 0 in shadow,
+    // averaged over (2 * pcf_radius + 1)^2 texels when pcf_radius > 0
+    [[nodiscard]] double visibility(const vec3& p) const;
+
+    int pcf_radius = 1;
+    double bias = 0.01; // in NDC depth, against acne on surfaces facing the light
+private:
+    int size;
+    Rasterizer rasterizer;
+    mat4 view, projection;
+    mat4 light_matrix; // world to shadow map pixels and NDC depth
+};
+
+#endif //SHADOW_H
@@ -0,0 +1,239 @@
+//
+// Created by laoe on 25-10-1.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+
+#include "simplify.h"
+
+namespace {
+
+// sum of squared distances to a set of planes, the symmetric 4x4 matrix stored as its upper triangle
+struct Quadric {
+    double a[10] = {};
+
+    static Quadric plane(const vec3& n, double d) {
+        return {{n.x * n.x, n.x * n.y, n.x * n.z, n.x * d, n.y * n.y, n.y * n.z, n.y * d, n.z * n.z, n.z * d, d * d}};
+    }
+    Quadric& operator+=(const Quadric& q) {
+        for (int i = 0; i < 10; i++) a[i] += q.a[i];
+        return *this;
+    }
+    [[nodiscard]] double eval(const vec3& p) const {
+        const double x = p.x, y = p.y, z = p.z;
+        return a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x + a[4] * y * y + 2 * a[5] * y * z +
+               2 * a[6] * y + a[7] * z * z + 2 * a[8] * z + a[9];
+    }
+};
+
+// distance from p to the triangle abc, through the closest point of the region p projects into
+double triangle_distance(const vec3& p, const vec3& a, const vec3& b, const vec3& c) {
+    const vec3 ab = b - a, ac = c - a, ap = p - a;
+    const double d1 = ab * ap, d2 = ac * ap;
+    if (d1 <= 0 && d2 <= 0) return norm(ap);
+    const vec3 bp = p - b;
+    const double d3 = ab * bp, d4 = ac * bp;
+    if (d3 >= 0 && d4 <= d3) return norm(bp);
+    const double vc = d1 * d4 - d3 * d2;
+    if (vc <= 0 && d1 >= 0 && d3 <= 0) return norm(p - (a + ab * (d1 / (d1 - d3))));
+    const vec3 cp = p - c;
+    const double d5 = ab * cp, d6 = ac * cp;
+    if (d6 >= 0 && d5 <= d6) return norm(cp);
+    const double vb = d5 * d2 - d1 * d6;
+    if (vb <= 0 && d2 >= 0 && d6 <= 0) return norm(p - (a + ac * (d2 / (d2 - d6))));
+    const double va = d3 * d6 - d5 * d4;
+    if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) return norm(p - (b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)))));
+    const double denominator = va + vb + vc;
+    if (denominator <= 0) return std::min({norm(ap), norm(bp), norm(cp)}); // degenerate, the nearest corner
+    return norm(p - (a + ab * (vb / denominator) + ac * (vc / denominator)));
+}
+
+struct Collapse {
+    double cost;
+    int from, to;
+    int from_version, to_version;
+    bool operator>(const Collapse& c) const { return cost > c.cost; }
+};
+
+// vertices that must not move: seams, where several vertices share a position, and the ends of edges that
+// do not have exactly two faces once vertices at the same position are treated as one
+std::vector<char> locked_vertices(std::span<const vec3> vertices, std::span<const int> indices) {
+    const int nvertex = static_cast<int>(vertices.size());
+    std::vector<int> order(nvertex), group(nvertex);
+    std::iota(order.begin(), order.end(), 0);
+    auto less = [&](int a, int b) {
+        const vec3 &p = vertices[a], &q = vertices[b];
+        return p.x != q.x ? p.x < q.x : p.y != q.y ? p.y < q.y : p.z < q.z;
+    };
+    std::sort(order.begin(), order.end(), less);
+    std::vector<char> locked(nvertex, 0);
+    for (int i = 0, g = 0; i < nvertex; g++) {
+        int j = i;
+        while (j < nvertex && !less(order[i], order[j])) group[order[j++]] = g;
+        if (j - i > 1) for (int k = i; k < j; k++) locked[order[k]] = 1;
+        i = j;
+    }
+
+    std::unordered_map<std::uint64_t, int> edge_faces;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        for (int j = 0; j < 3; j++) {
+            const std::uint64_t a = group[indices[i + j]], b = group[indices[i + (j + 1) % 3]];
+            edge_faces[std::min(a, b) << 32 | std::max(a, b)]++;
+        }
+    }
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        for (int j = 0; j < 3; j++) {
+            const int u = indices[i + j], v = indices[i + (j + 1) % 3];
+            const std::uint64_t a = group[u], b = group[v];
+            if (edge_faces[std::min(a, b) << 32 | std::max(a, b)] != 2) locked[u] = locked[v] = 1;
+        }
+    }
+    return locked;
+}
+
+}
+
+std::vector<int> simplify(std::span<const vec3> vertices, std::span<const int> indices, int target_faces, double& error) {
+    const int nvertex = static_cast<int>(vertices.size());
+    const int nface = static_cast<int>(indices.size() / 3);
+    std::vector<int> faces(indices.begin(), indices.begin() + nface * 3);
+    error = 0;
+
+    const std::vector<char> locked = locked_vertices(vertices, faces);
+    std::vector<Quadric> quadrics(nvertex);
+    std::vector<std::vector<int>> vertex_faces(nvertex);
+    std::vector<char> face_alive(nface, 1), vertex_alive(nvertex, 1);
+    std::vector<int> version(nvertex, 0);
+    std::vector<int> collapsed_to(nvertex, -1);
+    for (int f = 0; f < nface; f++) {
+        const int* idx = &faces[f * 3];
+        const vec3 n = (vertices[idx[1]] - vertices[idx[0]]) ^ (vertices[idx[2]] - vertices[idx[0]]);
+        const double length = norm(n);
+        if (length > 0) {
+            const vec3 unit = n / length;
+            const Quadric q = Quadric::plane(unit, -(unit * vertices[idx[0]]));
+            for (int j = 0; j < 3; j++) quadrics[idx[j]] += q;
+        }
+        for (int j = 0; j < 3; j++) vertex_faces[idx[j]].push_back(f);
+    }
+
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<>> queue;
+    auto push = [&](int from, int to) {
+        if (locked[from] || from == to) return;
+        Quadric q = quadrics[from];
+        q += quadrics[to];
+        queue.push({std::max(0., q.eval(vertices[to])), from, to, version[from], version[to]});
+    };
+    for (int f = 0; f < nface; f++) {
+        for (int j = 0; j < 3; j++) push(faces[f * 3 + j], faces[f * 3 + (j + 1) % 3]), push(faces[f * 3 + (j + 1) % 3], faces[f * 3 + j]);
+    }
+
+    auto face_normal = [&](int f, int from, const vec3& to) {
+        vec3 p[3];
+        for (int j = 0; j < 3; j++) p[j] = faces[f * 3 + j] == from ? to : vertices[faces[f * 3 + j]];
+        return (p[1] - p[0]) ^ (p[2] - p[0]);
+    };
+    auto contains = [&](int f, int v) { return faces[f * 3] == v || faces[f * 3 + 1] == v || faces[f * 3 + 2] == v; };
+    std::vector<int> neighbours_from, neighbours_to;
+    auto neighbours = [&](int v, std::vector<int>& out) {
+        out.clear();
+        for (int f : vertex_faces[v]) {
+            if (!face_alive[f]) continue;
+            for (int j = 0; j < 3; j++) if (faces[f * 3 + j] != v) out.push_back(faces[f * 3 + j]);
+        }
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+    };
+
+    int alive = nface;
+    while (alive > target_faces && !queue.empty()) {
+        const Collapse c = queue.top();
+        queue.pop();
+        if (!vertex_alive[c.from] || !vertex_alive[c.to] || version[c.from] != c.from_version || version[c.to] != c.to_version)
+            continue;
+
+        // the edge must still exist, and its two ends may share no neighbour but the ones across its faces,
+        // or the collapse would pinch the surface
+        int shared = 0;
+        for (int f : vertex_faces[c.from]) shared += face_alive[f] && contains(f, c.to);
+        if (shared == 0) continue;
+        neighbours(c.from, neighbours_from);
+        neighbours(c.to, neighbours_to);
+        std::vector<int> common;
+        std::set_intersection(neighbours_from.begin(), neighbours_from.end(), neighbours_to.begin(), neighbours_to.end(),
+                              std::back_inserter(common));
+        if (static_cast<int>(common.size()) != shared) continue;
+
+        // no remaining face may flip or degenerate
+        bool flips = false;
+        for (int f : vertex_faces[c.from]) {
+            if (!face_alive[f] || contains(f, c.to)) continue;
+            const vec3 before = face_normal(f, -1, {}), after = face_normal(f, c.from, vertices[c.to]);
+            if (after * before <= .25 * norm(after) * norm(before)) {
+                flips = true;
+                break;
+            }
+        }
+        if (flips) continue;
+
+        vertex_alive[c.from] = 0;
+        collapsed_to[c.from] = c.to;
+        quadrics[c.to] += quadrics[c.from];
+        version[c.to]++;
+        for (int f : vertex_faces[c.from]) {
+            if (!face_alive[f]) continue;
+            if (contains(f, c.to)) {
+                face_alive[f] = 0;
+                alive--;
+                continue;
+            }
+            for (int j = 0; j < 3; j++) if (faces[f * 3 + j] == c.from) faces[f * 3 + j] = c.to;
+            vertex_faces[c.to].push_back(f);
+        }
+        neighbours(c.to, neighbours_to);
+        for (int v : neighbours_to) push(c.to, v), push(v, c.to);
+    }
+
+    // error: the farthest any removed vertex ends up from the result, measured to the faces around the vertex it
+    // was collapsed into, which bounds its distance to the whole surface from above; the remaining vertices lie on it
+    for (int v = 0; v < nvertex; v++) {
+        if (vertex_alive[v]) continue;
+        int r = collapsed_to[v];
+        while (!vertex_alive[r]) r = collapsed_to[r];
+        for (int u = v; u != r; ) u = std::exchange(collapsed_to[u], r); // shortens the chains for the next ones
+        double nearest = std::numeric_limits<double>::infinity();
+        for (int f : vertex_faces[r]) {
+            if (!face_alive[f]) continue;
+            const int* idx = &faces[f * 3];
+            nearest = std::min(nearest, triangle_distance(vertices[v], vertices[idx[0]], vertices[idx[1]], vertices[idx[2]]));
+        }
+        if (nearest < std::numeric_limits<double>::infinity()) error = std::max(error, nearest);
+    }
+
+    std::vector<int> result;
+    result.reserve(alive * 3);
+    for (int f = 0; f < nface; f++)
+        if (face_alive[f]) result.insert(result.end(), faces.begin() + f * 3, faces.begin() + f * 3 + 3);
+    return result;
+}
+
+std::vector<LevelOfDetail> build_lods(std::span<const vec3> vertices, std::span<const int> indices, int max_levels) {
+    std::vector<LevelOfDetail> lods;
+    size_t faces = indices.size() / 3;
+    while (static_cast<int>(lods.size()) < max_levels) {
+        LevelOfDetail lod;
+        lod.indices = simplify(vertices, indices, static_cast<int>(faces / 2), lod.error);
+        if (lod.indices.empty() || lod.indices.size() / 3 > faces * 4 / 5)
+            break;
+        faces = lod.indices.size() / 3;
+        lods.push_back(std::move(lod));
+    }
+    return lods;
+}
@@ -0,0 +1,28 @@
+//
+// Created by laoe on 25-10-1.
+//
+
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+#include <span>
+#include <vector>
+
+#include "geometry.h"
+
+// Quadric error metric simplification (Garland & Heckbert 1997) by collapsing vertices onto one of their
+// neighbours, so the result indexes the same vertices and every per-vertex attribute stays valid. Vertices on
+// open borders and on attribute seams (several vertices at one position) never move, the result has no new cracks.
+// Stops at target_faces or when no collapse is left that keeps every face from flipping; error is set to an upper
+// bound on the distance from any vertex of the input to the surface of the result, in the units of the vertices.
+std::vector<int> simplify(std::span<const vec3> vertices, std::span<const int> indices, int target_faces, double& error);
+
+struct LevelOfDetail {
+    std::vector<int> indices;
+    double error;
+};
+
+// successively coarser levels, each simplified from the full mesh to half the faces of the one before,
+// until a level saves less than a fifth of the faces or max_levels are built; the full mesh is not included
+std::vector<LevelOfDetail> build_lods(std::span<const vec3> vertices, std::span<const int> indices, int max_levels = 5);
+
+#endif //SIMPLIFY_H
@@ -0,0 +1,140 @@
+//
+// Created by laoe on 25-9-24.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "texture.h"
+
+namespace {
+
+// repeat addressing, power-of-two sizes avoid the division
+inline int wrap(int i, int n) {
+    if ((n & (n - 1)) == 0) return i & (n - 1);
+    i %= n;
+    return i < 0 ? i + n : i;
+}
+
+// texture coordinates are reduced to [0, 1] when scaling them by a level size could leave the range of int, NaNs
+// go to 0, so the conversion in floor_int stays defined for any uv a model holds
+inline double reduce(double u) {
+    if (std::abs(u) < 0x1p12) return u;
+    return std::isfinite(u) ? u - std::floor(u) : 0.;
+}
+
+// floor without the libm call std::floor becomes on plain sse2 targets, v must fit in int
+inline int floor_int(double v) {
+    const int i = static_cast<int>(v);
+    return i - (v < i);
+}
+
+inline vec3 unpack(std::uint32_t texel) {
+    return {static_cast<double>(texel & 0xFF), static_cast<double>(texel >> 8 & 0xFF), static_cast<double>(texel >> 16 & 0xFF)};
+}
+
+inline std::uint32_t pack(std::uint32_t b, std::uint32_t g, std::uint32_t r, std::uint32_t a) {
+    return b | g << 8 | r << 16 | a << 24;
+}
+
+}
+
+Texture::Texture(const TGAImage& image) {
+    const int w = image.width(), h = image.height();
+    if (w <= 0 || h <= 0) return;
+
+    // level 0: convert every format to BGRA, grayscale is replicated into the three channels
+    Level base = make_level(w, h);
+    const std::uint8_t* src = image.buffer();
+    const int bpp = image.bytespp();
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            const std::uint8_t* p = src + (x + y * w) * bpp;
+            std::uint32_t texel;
+            if (bpp == TGAImage::GRAYSCALE) texel = pack(p[0], p[0], p[0], 255);
+            else if (bpp == TGAImage::RGB) texel = pack(p[0], p[1], p[2], 255);
+            else memcpy(&texel, p, sizeof(texel));
+            store(base, x, y, texel);
+        }
+    }
+    levels.push_back(std::move(base));
+
+    // box filtered mip chain down to 1x1, odd sizes clamp the footprint to the previous level
+    while (levels.back().width > 1 || levels.back().height > 1) {
+        const Level& prev = levels.back();
+        Level next = make_level(std::max(1, prev.width / 2), std::max(1, prev.height / 2));
+        for (int y = 0; y < next.height; y++) {
+            for (int x = 0; x < next.width; x++) {
+                const int x0 = std::min(2 * x, prev.width - 1), x1 = std::min(2 * x + 1, prev.width - 1);
+                const int y0 = std::min(2 * y, prev.height - 1), y1 = std::min(2 * y + 1, prev.height - 1);
+                const std::uint32_t t[4] = {fetch(prev, x0, y0), fetch(prev, x1, y0), fetch(prev, x0, y1), fetch(prev, x1, y1)};
+                std::uint32_t channels[4] = {0, 0, 0, 0};
+                for (std::uint32_t texel : t)
+                    for (int c = 0; c < 4; c++) channels[c] += texel >> (8 * c) & 0xFF;
+                store(next, x, y, pack((channels[0] + 2) / 4, (channels[1] + 2) / 4, (channels[2] + 2) / 4, (channels[3] + 2) / 4));
+            }
+        }
+        levels.push_back(std::move(next));
+    }
+}
+
+Texture::Level Texture::make_level(int w, int h) {
+    Level level {w, h, (w + block_size - 1) / block_size, {}};
+    level.texels.resize(level.blocks_x * ((h + block_size - 1) / block_size) * block_size * block_size);
+    return level;
+}
+
+void Texture::store(Level& level, int x, int y, std::uint32_t texel) {
+    const int block = x / block_size + y / block_size * level.blocks_x;
+    level.texels[block * block_size * block_size + y % block_size * block_size + x % block_size] = texel;
+}
+
+// x, y must already be wrapped into the level
+std::uint32_t Texture::fetch(const Level& level, int x, int y) const {
+    constexpr int mask = block_size - 1;
+    const int block = (x >> block_shift) + (y >> block_shift) * level.blocks_x;
+    return level.texels[(block << 2 * block_shift) + ((y & mask) << block_shift) + (x & mask)];
+}
+
+double Texture::lod(const vec2& duv_dx, const vec2& duv_dy) const {
+    const double w = levels[0].width, h = levels[0].height;
+    const double dx2 = duv_dx.x * duv_dx.x * w * w + duv_dx.y * duv_dx.y * h * h;
+    const double dy2 = duv_dy.x * duv_dy.x * w * w + duv_dy.y * duv_dy.y * h * h;
+    return 0.5 * std::log2(std::max({dx2, dy2, 1e-12}));
+}
+
+vec3 Texture::nearest(const Level& level, const vec2& uv) const {
+    const int x = floor_int(reduce(uv.x) * level.width);
+    const int y = floor_int((1. - reduce(uv.y)) * level.height);
+    return unpack(fetch(level, wrap(x, level.width), wrap(y, level.height)));
+}
+
+vec3 Texture::bilinear(const Level& level, const vec2& uv) const {
+    const double fx = reduce(uv.x) * level.width - .5, fy = (1. - reduce(uv.y)) * level.height - .5;
+    const int x_floor = floor_int(fx), y_floor = floor_int(fy);
+    const double tx = fx - x_floor, ty = fy - y_floor;
+    const int x0 = wrap(x_floor, level.width), x1 = wrap(x0 + 1, level.width);
+    const int y0 = wrap(y_floor, level.height), y1 = wrap(y0 + 1, level.height);
+    const vec3 top = unpack(fetch(level, x0, y0)) * (1 - tx) + unpack(fetch(level, x1, y0)) * tx;
+    const vec3 bottom = unpack(fetch(level, x0, y1)) * (1 - tx) + unpack(fetch(level, x1, y1)) * tx;
+    return top * (1 - ty) + bottom * ty;
+}
+
+vec3 Texture::sample(const vec2& uv, Filter filter, double lod) const {
+    if (levels.empty()) return {};
+    const int last = static_cast<int>(levels.size()) - 1;
+    lod = std::isnan(lod) ? 0. : std::clamp(lod, 0., static_cast<double>(last));
+    switch (filter) {
+        case Filter::Nearest:
+            return nearest(levels[static_cast<int>(lod + .5)], uv);
+        case Filter::Bilinear:
+            return bilinear(levels[static_cast<int>(lod + .5)], uv);
+        default: {
+            const int level = static_cast<int>(lod);
+            const double t = lod - level;
+            if (t == 0 || level == last) return bilinear(levels[level], uv);
+            return bilinear(levels[level], uv) * (1 - t) + bilinear(levels[level + 1], uv) * t;
+        }
+    }
+}
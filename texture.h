@@ -0,0 +1,54 @@
+//
+// Created by laoe on 25-9-24.
+//
+
+#ifndef TEXTURE_H
+#define TEXTURE_H
+#include <cstdint>
+#include <vector>
+
+#include "geometry.h"
+#include "tgaimage.h"
+
+// Read-only texture built from a TGAImage: a full mip chain whose texels are stored as packed BGRA
+// in 4x4 blocks (64 bytes, one cache line), so bilinear footprints and neighbouring pixels hit the same lines.
+// Texture coordinates follow the OBJ convention (v points up) and wrap around.
+class Texture {
+public:
+    enum class Filter { Nearest, Bilinear, Trilinear };
+
+    Texture() = default;
+    explicit Texture(const TGAImage& image);
+
+    [[nodiscard]] bool empty() const { return levels.empty(); }
+    [[nodiscard]] int width() const { return levels.empty() ? 0 : levels[0].width; }
+    [[nodiscard]] int height() const { return levels.empty() ? 0 : levels[0].height; }
+    [[nodiscard]] int level_count() const { return levels.size(); }
+
+    // level of detail from the screen-space derivatives of uv
+    [[nodiscard]] double lod(const vec2& duv_dx, const vec2& duv_dy) const;
+    // color in TGAColor channel order (b, g, r), 0..255; nearest and bilinear use the closest mip level,
+    // trilinear blends the two around lod
+    [[nodiscard]] vec3 sample(const vec2& uv, Filter filter = Filter::Bilinear, double lod = 0) const;
+    [[nodiscard]] vec3 sample(const vec2& uv, const vec2& duv_dx, const vec2& duv_dy, Filter filter = Filter::Trilinear) const {
+        return sample(uv, filter, lod(duv_dx, duv_dy));
+    }
+private:
+    struct Level {
+        int width, height;
+        int blocks_x; // blocks per row of texels
+        std::vector<std::uint32_t> texels;
+    };
+    static constexpr int block_shift = 2;
+    static constexpr int block_size = 1 << block_shift;
+
+    [[nodiscard]] std::uint32_t fetch(const Level& level, int x, int y) const;
+    [[nodiscard]] vec3 nearest(const Level& level, const vec2& uv) const;
+    [[nodiscard]] vec3 bilinear(const Level& level, const vec2& uv) const;
+    static Level make_level(int w, int h);
+    static void store(Level& level, int x, int y, std::uint32_t texel);
+
+    std::vector<Level> levels;
+};
+
+#endif //TEXTURE_H
@@ -1,22 +1,35 @@
 #include <iostream>
 #include <cstring>
+#include <algorithm>
 #include "tgaimage.h"
+#include "mappedfile.h"
+
+namespace {
+
+// one pixel as an integer so comparisons are a single word compare instead of a byte loop
+inline std::uint32_t pixel_word(const std::uint8_t *p, const int bpp) {
+    std::uint32_t word = 0;
+    memcpy(&word, p, bpp);
+    return word;
+}
+
+}
 
 TGAImage::TGAImage(const int w, const int h, const int bpp) : w(w), h(h), bpp(bpp), data(w*h*bpp, 0) {}
 
 bool TGAImage::read_tga_file(const std::string filename) {
-    std::ifstream in;
-    in.open(filename, std::ios::binary);
-    if (!in.is_open()) {
+    MappedFile file(filename);
+    if (!file.is_open()) {
         std::cerr << "can't open file " << filename << "\n";
         return false;
     }
+    const std::uint8_t *in = reinterpret_cast<const std::uint8_t *>(file.data());
     TGAHeader header;
-    in.read(reinterpret_cast<char *>(&header), sizeof(header));
-    if (!in.good()) {
+    if (file.size() < sizeof(header)) {
         std::cerr << "an error occured while reading the header\n";
         return false;
     }
+    memcpy(&header, in, sizeof(header));
     w   = header.width;
     h   = header.height;
     bpp = header.bitsperpixel>>3;
@@ -24,16 +37,18 @@ bool TGAImage::read_tga_file(const std::string filename) {
         std::cerr << "bad bpp (or width/height) value\n";
         return false;
     }
+    const size_t offset = sizeof(header) + header.idlength;
+    const size_t available = file.size() > offset ? file.size() - offset : 0;
     size_t nbytes = bpp*w*h;
     data = std::vector<std::uint8_t>(nbytes, 0);
     if (3==header.datatypecode || 2==header.datatypecode) {
-        in.read(reinterpret_cast<char *>(data.data()), nbytes);
-        if (!in.good()) {
+        if (available < nbytes) {
             std::cerr << "an error occured while reading the data\n";
             return false;
         }
+        memcpy(data.data(), in + offset, nbytes);
     } else if (10==header.datatypecode||11==header.datatypecode) {
-        if (!load_rle_data(in)) {
+        if (!load_rle_data(in + offset, available)) {
             std::cerr << "an error occured while reading the data\n";
             return false;
         }
@@ -49,120 +64,128 @@ bool TGAImage::read_tga_file(const std::string filename) {
     return true;
 }
 
-bool TGAImage::load_rle_data(std::ifstream &in) {
-    size_t pixelcount = w*h;
-    size_t currentpixel = 0;
-    size_t currentbyte  = 0;
-    TGAColor colorbuffer;
-    do {
-        std::uint8_t chunkheader = 0;
-        chunkheader = in.get();
-        if (!in.good()) {
+bool TGAImage::load_rle_data(const std::uint8_t *in, size_t size) {
+    const size_t nbytes = w*h*bpp;
+    const std::uint8_t *end = in + size;
+    size_t currentbyte = 0;
+    while (currentbyte < nbytes) {
+        if (in >= end) {
             std::cerr << "an error occured while reading the data\n";
             return false;
         }
+        std::uint8_t chunkheader = *in++;
         if (chunkheader<128) {
-            chunkheader++;
-            for (int i=0; i<chunkheader; i++) {
-                in.read(reinterpret_cast<char *>(colorbuffer.bgra), bpp);
-                if (!in.good()) {
-                    std::cerr << "an error occured while reading the header\n";
-                    return false;
-                }
-                for (int t=0; t<bpp; t++)
-                    data[currentbyte++] = colorbuffer.bgra[t];
-                currentpixel++;
-                if (currentpixel>pixelcount) {
-                    std::cerr << "Too many pixels read\n";
-                    return false;
-                }
+            const size_t chunkbytes = (chunkheader+1)*bpp;
+            if (currentbyte+chunkbytes>nbytes) {
+                std::cerr << "Too many pixels read\n";
+                return false;
             }
+            if (static_cast<size_t>(end-in)<chunkbytes) {
+                std::cerr << "an error occured while reading the header\n";
+                return false;
+            }
+            memcpy(data.data()+currentbyte, in, chunkbytes);
+            in += chunkbytes;
+            currentbyte += chunkbytes;
         } else {
-            chunkheader -= 127;
-            in.read(reinterpret_cast<char *>(colorbuffer.bgra), bpp);
-            if (!in.good()) {
+            const size_t chunkpixels = chunkheader-127;
+            if (currentbyte+chunkpixels*bpp>nbytes) {
+                std::cerr << "Too many pixels read\n";
+                return false;
+            }
+            if (end-in<bpp) {
                 std::cerr << "an error occured while reading the header\n";
                 return false;
             }
-            for (int i=0; i<chunkheader; i++) {
-                for (int t=0; t<bpp; t++)
-                    data[currentbyte++] = colorbuffer.bgra[t];
-                currentpixel++;
-                if (currentpixel>pixelcount) {
-                    std::cerr << "Too many pixels read\n";
-                    return false;
-                }
+            std::uint8_t *dst = data.data()+currentbyte;
+            if (1==bpp) {
+                memset(dst, *in, chunkpixels);
+            } else {
+                for (size_t i=0; i<chunkpixels; i++)
+                    memcpy(dst+i*bpp, in, bpp);
             }
+            in += bpp;
+            currentbyte += chunkpixels*bpp;
         }
-    } while (currentpixel < pixelcount);
+    }
     return true;
 }
 
-bool TGAImage::write_tga_file(const std::string filename, const bool vflip, const bool rle) const {
+std::vector<std::uint8_t> TGAImage::encode_tga(const bool vflip, const bool rle) const {
     constexpr std::uint8_t developer_area_ref[4] = {0, 0, 0, 0};
     constexpr std::uint8_t extension_area_ref[4] = {0, 0, 0, 0};
     constexpr std::uint8_t footer[18] = {'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'};
-    std::ofstream out;
-    out.open(filename, std::ios::binary);
-    if (!out.is_open()) {
-        std::cerr << "can't open file " << filename << "\n";
-        return false;
-    }
     TGAHeader header = {};
     header.bitsperpixel = bpp<<3;
     header.width  = w;
     header.height = h;
     header.datatypecode = (bpp==GRAYSCALE ? (rle?11:3) : (rle?10:2));
     header.imagedescriptor = vflip ? 0x00 : 0x20; // top-left or bottom-left origin
-    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
-    if (!out.good()) goto err;
-    if (!rle) {
-        out.write(reinterpret_cast<const char *>(data.data()), w*h*bpp);
-        if (!out.good()) goto err;
-    } else if (!unload_rle_data(out)) goto err;
-    out.write(reinterpret_cast<const char *>(developer_area_ref), sizeof(developer_area_ref));
-    if (!out.good()) goto err;
-    out.write(reinterpret_cast<const char *>(extension_area_ref), sizeof(extension_area_ref));
-    if (!out.good()) goto err;
-    out.write(reinterpret_cast<const char *>(footer), sizeof(footer));
-    if (!out.good()) goto err;
+
+    // the whole file in memory, so it goes to a stream or a socket in one write
+    const std::uint8_t *h = reinterpret_cast<const std::uint8_t *>(&header);
+    std::vector<std::uint8_t> out(h, h+sizeof(header));
+    out.reserve(sizeof(header) + (rle ? data.size()/2 : data.size()) + sizeof(footer) + 8);
+    if (!rle)
+        out.insert(out.end(), data.begin(), data.end());
+    else
+        unload_rle_data(out);
+    out.insert(out.end(), developer_area_ref, developer_area_ref+sizeof(developer_area_ref));
+    out.insert(out.end(), extension_area_ref, extension_area_ref+sizeof(extension_area_ref));
+    out.insert(out.end(), footer, footer+sizeof(footer));
+    return out;
+}
+
+bool TGAImage::write_tga_file(const std::string filename, const bool vflip, const bool rle) const {
+    const std::vector<std::uint8_t> out = encode_tga(vflip, rle);
+    std::ofstream file;
+    file.open(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    file.write(reinterpret_cast<const char *>(out.data()), out.size());
+    if (!file.good()) {
+        std::cerr << "can't dump the tga file\n";
+        return false;
+    }
     return true;
-err:
-    std::cerr << "can't dump the tga file\n";
-    return false;
 }
 
-bool TGAImage::unload_rle_data(std::ofstream &out) const {
-    const std::uint8_t max_chunk_length = 128;
-    size_t npixels = w*h;
+// Chunks are cut exactly like the byte-by-byte encoder this replaces: a run chunk covers consecutive equal
+// pixels, a raw chunk stops right before the first pair of equal pixels, both at most 128 pixels long.
+void TGAImage::unload_rle_data(std::vector<std::uint8_t> &out) const {
+    const size_t max_chunk_length = 128;
+    const size_t npixels = w*h;
+    const std::uint8_t *pixels = data.data();
+    auto pixel = [&](size_t i) { return pixel_word(pixels+i*bpp, bpp); };
     size_t curpix = 0;
     while (curpix<npixels) {
-        size_t chunkstart = curpix*bpp;
-        size_t curbyte = curpix*bpp;
-        std::uint8_t run_length = 1;
-        bool raw = true;
-        while (curpix+run_length<npixels && run_length<max_chunk_length) {
-            bool succ_eq = true;
-            for (int t=0; succ_eq && t<bpp; t++)
-                succ_eq = (data[curbyte+t]==data[curbyte+t+bpp]);
-            curbyte += bpp;
-            if (1==run_length)
-                raw = !succ_eq;
-            if (raw && succ_eq) {
-                run_length--;
-                break;
+        const size_t max_length = std::min(max_chunk_length, npixels-curpix);
+        size_t run_length = 1;
+        if (max_length>1 && pixel(curpix)==pixel(curpix+1)) {
+            const std::uint32_t value = pixel(curpix);
+            run_length = 2;
+            while (run_length<max_length && pixel(curpix+run_length)==value)
+                run_length++;
+            out.push_back(run_length+127);
+            out.insert(out.end(), pixels+curpix*bpp, pixels+(curpix+1)*bpp);
+        } else {
+            std::uint32_t previous = max_length>1 ? pixel(curpix+1) : 0;
+            run_length = max_length;
+            for (size_t k=2; k<max_length; k++) {
+                const std::uint32_t current = pixel(curpix+k);
+                if (current==previous) {
+                    run_length = k-1;
+                    break;
+                }
+                previous = current;
             }
-            if (!raw && !succ_eq)
-                break;
-            run_length++;
+            out.push_back(run_length-1);
+            out.insert(out.end(), pixels+curpix*bpp, pixels+(curpix+run_length)*bpp);
         }
         curpix += run_length;
-        out.put(raw ? run_length-1 : run_length+127);
-        if (!out.good()) return false;
-        out.write(reinterpret_cast<const char *>(data.data()+chunkstart), (raw?run_length*bpp:bpp));
-        if (!out.good()) return false;
     }
-    return true;
 }
 
 TGAColor TGAImage::get(const int x, const int y) const {
@@ -179,17 +202,21 @@ void TGAImage::set(int x, int y, const TGAColor &c) {
 }
 
 void TGAImage::flip_horizontally() {
-    for (int i=0; i<w/2; i++)
-        for (int j=0; j<h; j++)
-            for (int b=0; b<bpp; b++)
-                std::swap(data[(i+j*w)*bpp+b], data[(w-1-i+j*w)*bpp+b]);
+    std::uint8_t tmp[4];
+    for (int j=0; j<h; j++) {
+        std::uint8_t *left = data.data()+j*w*bpp, *right = left+(w-1)*bpp;
+        for (; left<right; left+=bpp, right-=bpp) {
+            memcpy(tmp, left, bpp);
+            memcpy(left, right, bpp);
+            memcpy(right, tmp, bpp);
+        }
+    }
 }
 
 void TGAImage::flip_vertically() {
-    for (int i=0; i<w; i++)
-        for (int j=0; j<h/2; j++)
-            for (int b=0; b<bpp; b++)
-                std::swap(data[(i+j*w)*bpp+b], data[(i+(h-1-j)*w)*bpp+b]);
+    const size_t line = w*bpp;
+    for (int j=0; j<h/2; j++)
+        std::swap_ranges(data.begin()+j*line, data.begin()+(j+1)*line, data.begin()+(h-1-j)*line);
 }
 
 int TGAImage::width() const {
@@ -199,4 +226,3 @@ int TGAImage::width() const {
 int TGAImage::height() const {
     return h;
 }
-
@@ -32,15 +32,20 @@ struct TGAImage {
     TGAImage(const int w, const int h, const int bpp);
     bool  read_tga_file(const std::string filename);
     bool write_tga_file(const std::string filename, const bool vflip=true, const bool rle=true) const;
+    // the bytes write_tga_file writes
+    std::vector<std::uint8_t> encode_tga(const bool vflip=true, const bool rle=true) const;
     void flip_horizontally();
     void flip_vertically();
     TGAColor get(const int x, const int y) const;
     void set(const int x, const int y, const TGAColor &c);
     int width()  const;
     int height() const;
+    int bytespp() const { return bpp; }
+    std::uint8_t* buffer() { return data.data(); }
+    const std::uint8_t* buffer() const { return data.data(); }
 private:
-    bool   load_rle_data(std::ifstream &in);
-    bool unload_rle_data(std::ofstream &out) const;
+    bool   load_rle_data(const std::uint8_t *in, size_t size);
+    void unload_rle_data(std::vector<std::uint8_t> &out) const;
     int w = 0, h = 0;
     std::uint8_t bpp = 0;
     std::vector<std::uint8_t> data = {};